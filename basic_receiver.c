@@ -33,35 +33,135 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <getopt.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
+#include <rte_launch.h>
+#include <rte_malloc.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+
+#include "txrx_time.h"
+#include "txrx_stats.h"
+#include "txrx_probe.h"
+#include "txrx_conf.h"
+#include "txrx_numa.h"
+#include "txrx_poll.h"
+#include "txrx_idle.h"
+#include "txrx_cksum.h"
+#include "txrx_verify.h"
+#include "txrx_capture.h"
+
+/* Default pool size, deep enough to absorb long stalls of the lcores. */
+#define NUM_MBUFS (8191 * 64)
+
+#define FLOW_TABLE_SIZE 65536	/* flows tracked per polling lcore */
+#define FLOW_TOP_MAX 64		/* bound of --top-flows */
+
+/* Flows printed by packets and by bytes, 0 for no per-flow counters. */
+static unsigned flow_top_n;
 
-#define RX_RING_SIZE 128
-#define TX_RING_SIZE 512
+static const struct rte_eth_conf port_conf_default = {
+	.rxmode = {
+		.mq_mode = ETH_MQ_RX_RSS,
+		.max_rx_pkt_len = ETHER_MAX_LEN,
+	},
+	.rx_adv_conf = {
+		.rss_conf = {
+			.rss_key = NULL,
+			.rss_hf = ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP,
+		},
+	},
+};
 
-#define NUM_MBUFS 8191
-#define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 32
+/* 5-tuple of a received flow, the key of the per-lcore flow tables. */
+struct flow_key {
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint32_t proto;
+};
 
-static const struct rte_eth_conf port_conf_default = {
-	.rxmode = { .max_rx_pkt_len = ETHER_MAX_LEN }
+/*
+ * State of one flow, kept at the position its key has in the hash. The
+ * reporter walks the table by position and reads the key from here; used
+ * is set once the key is written.
+ */
+struct rx_flow {
+	struct txrx_seq_win seq;
+	uint64_t pkts;
+	uint64_t bytes;
+	struct flow_key key;
+	volatile uint8_t used;
 };
 
-static uint64_t
-get_ns_time(void)
-{
-    struct timespec ts;
-    timespec_get(&ts, TIME_UTC);
-    return (uint64_t) ts.tv_nsec;	
-}
+/* Packets and bytes of a flow, as the reporter last saw them. */
+struct flow_count {
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+/* A flow ranked by the reporter, over an interval or the whole run. */
+struct flow_top {
+	const struct rx_flow *flow;
+	unsigned lcore;
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+/*
+ * Per-lcore RX context. Each polling lcore owns one RX queue; its counters
+ * sit on their own cache line and are only written by that lcore, the
+ * stats reporter just reads and sums them.
+ */
+struct lcore_rx_ctx {
+	uint8_t port;
+	uint16_t queue;
+	uint8_t enabled;
+
+	uint64_t rx_pkts;
+	uint64_t rx_bytes;
+	uint64_t start_tsc;	/* first packet seen on this queue */
+	struct txrx_lat_hist *lat;	/* latency of the sender's probes */
+
+	/* RSS keeps a flow on one queue, so flow tables are per lcore too. */
+	struct rte_hash *flow_hash;
+	struct rx_flow *flows;
+	uint64_t flow_overflow;		/* packets of flows that did not fit */
+	struct txrx_seq_stats seq;
+	struct txrx_cksum_stats cksum;	/* with --rx-cksum only */
+	struct txrx_verify_stats verify;	/* with --verify only */
+	struct rte_ring *capture;	/* to the writer, --capture only */
+	uint64_t capture_drops;		/* whole run, warm-up included */
+
+	struct txrx_poll_lcore poll;	/* with TXRX_POLL_STATS only */
+	struct txrx_idle idle;
+	unsigned epoch;			/* warm-up epoch of the counters */
+} __rte_cache_aligned;
+
+/* Everything the reporter sums over the polling lcores. */
+struct rx_sample {
+	struct txrx_sample io;
+	struct txrx_seq_stats seq;
+	uint64_t flow_overflow;
+	struct txrx_lat_hist lat;
+};
+
+static struct lcore_rx_ctx rx_ctx[RTE_MAX_LCORE];
 
+/* Per polling lcore and flow position, with --top-flows only. */
+static struct flow_count *flow_last[RTE_MAX_LCORE];
 
 static void 
-print_eth_stats(uint8_t portid, uint64_t timediff, uint64_t rx_count)
+print_eth_stats(uint8_t portid, uint64_t cycles, uint64_t rx_count,
+		uint64_t rx_bytes)
 {
 	struct rte_eth_stats stats;
 
@@ -70,44 +170,58 @@ print_eth_stats(uint8_t portid, uint64_t timediff, uint64_t rx_count)
 	}
 
 	//printf("TX port %"PRIu8 ":\n", portid);
-	printf("time diff: %"PRIu64 "ns \n", timediff);
+	printf("time diff: %"PRIu64 "ns \n", txrx_cycles_to_ns(cycles));
 	printf("stats ipackets %"PRIu64 "\n", stats.ipackets);
 	printf("stats opackets %"PRIu64 "\n", stats.opackets);
 	printf("stats ibytes %"PRIu64 "\n", stats.ibytes);
 	printf("stats obytes %"PRIu64 "\n", stats.obytes);
-	printf("count opackets %"PRIu64 "\n", rx_count);
-	printf("count obytes %"PRIu64 "\n", rx_count*64);
-	double timediff_in_second = (double) timediff/ (double) 1000000000;
-	double stats_thru = (double) stats.ibytes/ timediff_in_second;
-	double count_thru = rx_count*64/timediff_in_second;
-	printf("throughput on stats: %f \n", stats_thru);
-	printf("throughput on counts: %f \n", count_thru);
-
+	printf("count ipackets %"PRIu64 "\n", rx_count);
+	printf("count ibytes %"PRIu64 "\n", rx_bytes);
+	txrx_print_rate("throughput on stats", stats.ipackets, stats.ibytes,
+			cycles);
+	txrx_print_rate("throughput on counts", rx_count, rx_bytes, cycles);
 }
 
 /*
  * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * coming from the mbuf_pool passed as a parameter. With more than one RX
+ * queue the port spreads incoming flows over them with RSS.
  */
 static inline int
-port_init(uint8_t port, struct rte_mempool *mbuf_pool)
+port_init(uint8_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	struct rte_eth_dev_info dev_info;
+	const uint16_t tx_rings = 1;
 	int retval;
 	uint16_t q;
 
 	if (port >= rte_eth_dev_count())
 		return -1;
 
+	rte_eth_dev_info_get(port, &dev_info);
+	if (rx_rings > dev_info.max_rx_queues) {
+		printf("Port %u supports only %u RX queues, %u requested\n",
+				(unsigned)port, dev_info.max_rx_queues,
+				(unsigned)rx_rings);
+		return -1;
+	}
+
+	/* Only hash on what the device can hash on, RSS is pointless for 1 queue. */
+	port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
+	if (rx_rings == 1 || port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+		port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+	port_conf.intr_conf.rxq = txrx_idle_intr();
+	txrx_cksum_port_conf(port, &dev_info, &port_conf);
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
 		return retval;
 
-	/* Allocate and set up 1 RX queue per Ethernet port. */
+	/* Allocate and set up 1 RX queue per polling lcore. */
 	for (q = 0; q < rx_rings; q++) {
-		retval = rte_eth_rx_queue_setup(port, q, RX_RING_SIZE,
+		retval = rte_eth_rx_queue_setup(port, q, txrx_conf.rx_ring_size,
 				rte_eth_dev_socket_id(port), NULL, mbuf_pool);
 		if (retval < 0)
 			return retval;
@@ -115,7 +229,7 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 
 	/* Allocate and set up 1 TX queue per Ethernet port. */
 	for (q = 0; q < tx_rings; q++) {
-		retval = rte_eth_tx_queue_setup(port, q, TX_RING_SIZE,
+		retval = rte_eth_tx_queue_setup(port, q, txrx_conf.tx_ring_size,
 				rte_eth_dev_socket_id(port), NULL);
 		if (retval < 0)
 			return retval;
@@ -143,82 +257,565 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 }
 
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * Sums the counters, sequence stats and latency histograms of all polling
+ * lcores and reads the port counters.
  */
-static __attribute__((noreturn)) void
-lcore_main(void)
+static void
+sample_rx_stats(uint8_t port, struct rx_sample *sample)
 {
-	const uint8_t nb_ports = rte_eth_dev_count();
-	uint8_t port;
+	unsigned lcore_id;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->io.tsc = rte_rdtsc();
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_rx_ctx *ctx = &rx_ctx[lcore_id];
+
+		if (!ctx->enabled)
+			continue;
+		sample->io.pkts += ctx->rx_pkts;
+		sample->io.bytes += ctx->rx_bytes;
+		sample->flow_overflow += ctx->flow_overflow;
+		txrx_seq_merge(&sample->seq, &ctx->seq);
+		txrx_lat_merge(&sample->lat, ctx->lat);
+	}
+	rte_eth_stats_get(port, &sample->io.eth);
+}
+
+/* Packets received so far, for --count. */
+static uint64_t
+count_rx_pkts(void)
+{
+	uint64_t pkts = 0;
+	unsigned lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (rx_ctx[lcore_id].enabled)
+			pkts += rx_ctx[lcore_id].rx_pkts;
+	}
+	return pkts;
+}
+
+/* Puts f into top, n flows by packets or bytes, if it ranks there. */
+static void
+flow_top_insert(struct flow_top *top, unsigned n, const struct flow_top *f,
+		int by_bytes)
+{
+	const uint64_t v = by_bytes ? f->bytes : f->pkts;
+	unsigned i = n;
+
+	while (i > 0 && v > (by_bytes ? top[i - 1].bytes : top[i - 1].pkts))
+		i--;
+	if (i == n)
+		return;
+	memmove(&top[i + 1], &top[i], (n - i - 1) * sizeof(*top));
+	top[i] = *f;
+}
+
+static void
+flow_top_print_list(const char *indent, const char *what,
+		const struct flow_top *top, uint64_t total, int by_bytes)
+{
+	unsigned i;
+
+	printf("%stop flows by %s:\n", indent, what);
+	for (i = 0; i < flow_top_n && top[i].flow != NULL; i++) {
+		const struct flow_key *k = &top[i].flow->key;
+		const uint32_t src = rte_be_to_cpu_32(k->src_ip);
+		const uint32_t dst = rte_be_to_cpu_32(k->dst_ip);
+
+		printf("%s  %u.%u.%u.%u:%u > %u.%u.%u.%u:%u proto %u, "
+				"lcore %u: %" PRIu64 " pkts, %" PRIu64
+				" bytes (%.1f%%)\n", indent,
+				src >> 24, (src >> 16) & 0xff,
+				(src >> 8) & 0xff, src & 0xff,
+				rte_be_to_cpu_16(k->src_port),
+				dst >> 24, (dst >> 16) & 0xff,
+				(dst >> 8) & 0xff, dst & 0xff,
+				rte_be_to_cpu_16(k->dst_port), k->proto,
+				top[i].lcore, top[i].pkts, top[i].bytes,
+				100.0 * (by_bytes ? top[i].bytes :
+					top[i].pkts) / total);
+	}
+}
+
+/*
+ * Merges the flow tables of the polling lcores and prints the top flows
+ * by packets and by bytes, over the whole run or, with interval set,
+ * since the last interval. RSS keeps a flow on one queue, so no two tables
+ * share a flow and merging is walking them all. The lcores keep counting
+ * meanwhile; a flow is only read once its key is complete.
+ */
+static void
+flow_top_print(const char *indent, int interval)
+{
+	struct flow_top by_pkts[FLOW_TOP_MAX], by_bytes[FLOW_TOP_MAX];
+	uint64_t pkts = 0, bytes = 0;
+	unsigned lcore_id, pos, nb_flows = 0, nb_active = 0;
+
+	memset(by_pkts, 0, sizeof(by_pkts));
+	memset(by_bytes, 0, sizeof(by_bytes));
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_rx_ctx *ctx = &rx_ctx[lcore_id];
+
+		if (!ctx->enabled)
+			continue;
+		for (pos = 0; pos < FLOW_TABLE_SIZE; pos++) {
+			const struct rx_flow *flow = &ctx->flows[pos];
+			struct flow_top f = {
+				.flow = flow,
+				.lcore = lcore_id,
+			};
+
+			if (!flow->used)
+				continue;
+			rte_smp_rmb();
+			nb_flows++;
+			f.pkts = flow->pkts;
+			f.bytes = flow->bytes;
+			if (interval) {
+				struct flow_count *last = &flow_last[lcore_id][pos];
+				const struct flow_count now = {
+					.pkts = f.pkts,
+					.bytes = f.bytes,
+				};
+
+				f.pkts -= last->pkts;
+				f.bytes -= last->bytes;
+				*last = now;
+			}
+			if (f.pkts == 0)
+				continue;
+			nb_active++;
+			pkts += f.pkts;
+			bytes += f.bytes;
+			flow_top_insert(by_pkts, flow_top_n, &f, 0);
+			flow_top_insert(by_bytes, flow_top_n, &f, 1);
+		}
+	}
+	printf("%sflows: %u tracked, %u with packets\n", indent, nb_flows,
+			nb_active);
+	if (nb_active == 0)
+		return;
+	flow_top_print_list(indent, "packets", by_pkts, pkts, 0);
+	flow_top_print_list(indent, "bytes", by_bytes, bytes, 1);
+}
+
+/* Forgets the interval counts, once the lcores restarted theirs. */
+static void
+flow_top_reset(void)
+{
+	unsigned lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (flow_last[lcore_id] != NULL)
+			memset(flow_last[lcore_id], 0,
+					FLOW_TABLE_SIZE * sizeof(struct flow_count));
+	}
+}
+
+/*
+ * Prints the per-queue counters and the totals together with the port
+ * statistics. The run is timed from the first packet seen by any lcore
+ * after the warm-up.
+ */
+static void
+report_rx_stats(uint8_t port)
+{
+	struct rx_sample *total = calloc(1, sizeof(*total));
+	struct txrx_cksum_stats cksum = { 0 };
+	struct txrx_verify_stats verify = { 0 };
+	uint64_t start_tsc = 0, capture_drops = 0;
+	unsigned lcore_id, nb_lcores = 0;
+
+	if (total == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate stats sample\n");
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_rx_ctx *ctx = &rx_ctx[lcore_id];
+
+		if (!ctx->enabled)
+			continue;
+		printf("queue %u (lcore %u): ipackets %" PRIu64 "\n",
+				ctx->queue, lcore_id, ctx->rx_pkts);
+		txrx_poll_print(lcore_id, &ctx->poll, txrx_conf.burst);
+		txrx_cksum_merge(&cksum, &ctx->cksum);
+		txrx_verify_merge(&verify, &ctx->verify);
+		capture_drops += ctx->capture_drops;
+		nb_lcores++;
+		if (ctx->start_tsc != 0 &&
+				(start_tsc == 0 || ctx->start_tsc < start_tsc))
+			start_tsc = ctx->start_tsc;
+	}
+	sample_rx_stats(port, total);
+	if (start_tsc != 0) {
+		RTE_LCORE_FOREACH(lcore_id) {
+			if (rx_ctx[lcore_id].enabled)
+				txrx_idle_print(lcore_id, &rx_ctx[lcore_id].idle,
+						total->io.tsc - start_tsc);
+		}
+		print_eth_stats(port, total->io.tsc - start_tsc, total->io.pkts,
+				total->io.bytes);
+		txrx_lat_print("latency", &total->lat);
+		txrx_seq_print("sequence", &total->seq, NULL);
+		txrx_cksum_print("checksums", &cksum);
+		txrx_verify_print("payloads", &verify);
+		txrx_capture_print(capture_drops);
+		if (flow_top_n != 0)
+			flow_top_print("", 0);
+		if (total->flow_overflow != 0)
+			printf("flow tables full: %" PRIu64 " packets not "
+					"tracked\n", total->flow_overflow);
+		txrx_print_result("rx", nb_lcores, total->io.pkts,
+				total->io.bytes, total->io.eth.imissed +
+				total->io.eth.rx_nombuf,
+				total->io.tsc - start_tsc);
+	}
+	free(total);
+}
+
+/*
+ * The stats reporter. Every STATS_INTERVAL_MS it samples the polling
+ * lcores and the port and prints the deltas, so the polling lcores never
+ * print anything. Once the run is over it prints the last interval.
+ */
+static void
+report_loop(uint8_t port)
+{
+	const uint64_t interval = txrx_ns_to_cycles(STATS_INTERVAL_MS * 1000000ULL);
+	struct rx_sample *prev, *cur, *tmp;
+	struct txrx_lat_hist *lat_delta;
+	struct txrx_xstats xstats;
+	struct txrx_run run;
+	uint64_t start_tsc;
+	unsigned lcore_id, nb_lcores = 0;
+	int stop;
+
+	prev = calloc(1, sizeof(*prev));
+	cur = calloc(1, sizeof(*cur));
+	lat_delta = calloc(1, sizeof(*lat_delta));
+	if (prev == NULL || cur == NULL || lat_delta == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate stats samples\n");
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (rx_ctx[lcore_id].enabled)
+			nb_lcores++;
+	}
+	txrx_xstats_init(&xstats, port);
+	txrx_run_start(&run, nb_lcores, count_rx_pkts);
+	sample_rx_stats(port, prev);
+	start_tsc = prev->io.tsc;
+	do {
+		stop = txrx_run_wait(&run, prev->io.tsc + interval);
+		if (txrx_run_warm(&run)) {
+			txrx_port_stats_reset(port, &xstats);
+			sample_rx_stats(port, prev);
+			flow_top_reset();
+			continue;
+		}
+		sample_rx_stats(port, cur);
+		txrx_print_interval("RX", start_tsc, &prev->io, &cur->io);
+		txrx_lat_delta(lat_delta, &cur->lat, &prev->lat);
+		txrx_lat_print("    latency", lat_delta);
+		txrx_seq_print("    sequence", &cur->seq, &prev->seq);
+		if (flow_top_n != 0)
+			flow_top_print("    ", 1);
+		txrx_xstats_print(&xstats, port);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	} while (!stop);
+	txrx_xstats_free(&xstats);
+	free(prev);
+	free(cur);
+	free(lat_delta);
+}
+
+/*
+ * Finds or adds the flow of an IPv4 packet in the lcore's table. Returns
+ * NULL for other packets and when the table is full. Protocols other than
+ * UDP and TCP, and later fragments, make flows without ports.
+ */
+static inline struct rx_flow *
+rx_flow_lookup(struct lcore_rx_ctx *ctx, struct rte_mbuf *m)
+{
+	const struct ether_hdr *eth = rte_pktmbuf_mtod(m,
+			const struct ether_hdr *);
+	const struct ipv4_hdr *ip = (const struct ipv4_hdr *) (eth + 1);
+	/* TCP has its ports at the same place */
+	const struct udp_hdr *udp = (const struct udp_hdr *) (ip + 1);
+	struct rx_flow *flow;
+	hash_sig_t sig;
+	int32_t pos;
+
+	if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+			rte_pktmbuf_data_len(m) <
+			sizeof(*eth) + sizeof(*ip) + sizeof(*udp))
+		return NULL;
+
+	const int ports = (ip->next_proto_id == IPPROTO_UDP ||
+			ip->next_proto_id == IPPROTO_TCP) &&
+			ip->version_ihl == 0x45 &&
+			(ip->fragment_offset &
+			 rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK)) == 0;
+	const struct flow_key key = {
+		.src_ip = ip->src_addr,
+		.dst_ip = ip->dst_addr,
+		.src_port = ports ? udp->src_port : 0,
+		.dst_port = ports ? udp->dst_port : 0,
+		.proto = ip->next_proto_id,
+	};
 
 	/*
-	 * Check that the port is on the same NUMA node as the polling thread
-	 * for best performance.
+	 * Reuse the NIC's RSS hash when there is one. Its low bits picked
+	 * this queue, so they are nearly constant here; rotate the high bits
+	 * down, as rte_hash picks buckets from the low ones.
 	 */
-	for (port = 0; port < nb_ports; port++)
-		if (rte_eth_dev_socket_id(port) > 0 &&
-				rte_eth_dev_socket_id(port) !=
-						(int)rte_socket_id())
-			printf("WARNING, port %u is on remote NUMA node to "
-					"polling thread.\n\tPerformance will "
-					"not be optimal.\n", port);
-
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-			rte_lcore_id());
-	
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-	/* on the current machine, mellanox NIC is on port 0, so we enforce the port=0 here*/
-	port=0;
-	//FILE *fp;
-	//fp = fopen("/tmp/dump.txt", "w");
-
-	
-	uint64_t rx_count=0;
-	uint64_t counter=0;
-	uint8_t flag=0;
-	uint64_t start_time=0;
-	/* Run until the application is quit or killed. */
-	for (;;) {
-	//for(int j = 0; j < 65536; j++){	
+	if (m->ol_flags & PKT_RX_RSS_HASH)
+		sig = (m->hash.rss >> 16) | (m->hash.rss << 16);
+	else
+		sig = rte_hash_crc(&key, sizeof(key), 0);
+
+	pos = rte_hash_lookup_with_hash(ctx->flow_hash, &key, sig);
+	if (unlikely(pos < 0)) {
+		pos = rte_hash_add_key_with_hash(ctx->flow_hash, &key, sig);
+		if (pos < 0) {
+			ctx->flow_overflow++;
+			return NULL;
+		}
+		flow = &ctx->flows[pos];
+		memset(flow, 0, sizeof(*flow));
+		flow->key = key;
+		rte_smp_wmb();
+		flow->used = 1;
+	}
+	return &ctx->flows[pos];
+}
+
+static void *
+report_thread(void *arg)
+{
+	report_loop(*(uint8_t *) arg);
+	return NULL;
+}
+
+/* Drops what the lcore counted during the warm-up. */
+static void
+lcore_rx_restart(struct lcore_rx_ctx *ctx)
+{
+	ctx->rx_pkts = 0;
+	ctx->rx_bytes = 0;
+	ctx->start_tsc = 0;
+	ctx->flow_overflow = 0;
+	memset(ctx->lat, 0, sizeof(*ctx->lat));
+	memset(&ctx->seq, 0, sizeof(ctx->seq));
+	memset(&ctx->cksum, 0, sizeof(ctx->cksum));
+	memset(&ctx->verify, 0, sizeof(ctx->verify));
+	for (unsigned i = 0; i < FLOW_TABLE_SIZE; i++) {
+		ctx->flows[i].pkts = 0;
+		ctx->flows[i].bytes = 0;
+	}
+	txrx_poll_reset(&ctx->poll);
+	txrx_idle_reset(&ctx->idle);
+	txrx_epoch_ack(&ctx->epoch);
+}
+
+/*
+ * The RX loop. Every polling lcore runs it on its own queue and only
+ * updates its own counters; reporting is left to report_loop.
+ */
+static int
+lcore_rx(void *arg)
+{
+	struct lcore_rx_ctx *ctx = arg;
+	const uint8_t port = ctx->port;
+	const uint16_t queue = ctx->queue;
+	const uint16_t burst = txrx_conf.burst;
+	const int verify = txrx_verify_conf.kernel != VERIFY_OFF;
+
+	txrx_check_lcore_socket(rte_lcore_id(), port);
+	txrx_idle_init(&ctx->idle);
+	txrx_idle_add_queue(&ctx->idle, port, queue);
+
+	printf("\nCore %u receiving packets on queue %u. [Ctrl+C to quit]\n",
+			rte_lcore_id(), queue);
+
+	/* Run until --duration or --count is up or the application is killed. */
+	txrx_wait_go();
+	txrx_poll_loop_begin(&ctx->poll);
+	while (!txrx_quit) {
 		/* Get burst of RX packets */
-		struct rte_mbuf *bufs[BURST_SIZE];
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_rx_restart(ctx);
 		/* pull mode devices, so most the time nb_rx can be 0 */ 
-		uint16_t nb_rx = rte_eth_rx_burst(port, 0, bufs, BURST_SIZE);
-		rx_count +=(uint64_t)nb_rx;
-		if(nb_rx>0 && flag==0){
-			//printf("%" PRIu64 "\n", rx_count);
-			start_time=get_ns_time();
-			printf("timer starts!\n");
-			flag=1;
-		}
-		/*else //if(nb_rx>0 && flag==1)
-			printf("%" PRIu64 "\n", rx_count);
-		*/
-		// 2^24	
-		if(counter!= 0 && counter%16777216 == 0 && flag == 1){
-			uint64_t end_time=get_ns_time();
-			print_eth_stats(port, end_time-start_time, rx_count);
-		}
-		counter++;
-		/*if (fp != NULL){
- 			//fprintf(fp, "Port number %d \n", port);
-			for(int i=0;i < nb_rx;i++){
- 				rte_pktmbuf_dump(fp, bufs[i], sizeof(bufs[i]));
-				count++;
+		const uint64_t poll_tsc = txrx_poll_start();
+		uint16_t nb_rx = rte_eth_rx_burst(port, queue, bufs, burst);
+		txrx_poll_end(&ctx->poll.rx, poll_tsc, nb_rx, burst);
+		const int woke = txrx_idle_poll(&ctx->idle, nb_rx);
+		if (nb_rx == 0)
+			continue;
+		if (unlikely(woke))
+			txrx_idle_woke(&ctx->idle, bufs[0]);
+		const uint64_t now = rte_rdtsc();
+		if (unlikely(ctx->start_tsc == 0))
+			ctx->start_tsc = now;
+		ctx->rx_pkts +=(uint64_t)nb_rx;
+		if (txrx_cksum_conf.check)
+			txrx_cksum_burst(&ctx->cksum, bufs, nb_rx);
+		for(int i=0;i< nb_rx;i++) {
+			const struct txrx_probe *probe = txrx_probe_get(bufs[i]);
+			const uint32_t len = rte_pktmbuf_pkt_len(bufs[i]);
+
+			/* every packet's flow with --top-flows, else probes' */
+			if (probe != NULL || flow_top_n != 0) {
+				struct rx_flow *flow = rx_flow_lookup(ctx, bufs[i]);
+
+				if (flow != NULL) {
+					flow->pkts++;
+					flow->bytes += len;
+				}
+				if (probe != NULL) {
+					txrx_lat_record(ctx->lat, now, probe->tsc);
+					if (verify)
+						txrx_verify_probe(&ctx->verify,
+								bufs[i], probe);
+					if (flow != NULL)
+						txrx_seq_track(&flow->seq,
+								probe->seq,
+								&ctx->seq);
+				}
 			}
-			printf("%" PRIu16 "\n",count);
+			ctx->rx_bytes += len;
+			if (ctx->capture == NULL)
+				rte_pktmbuf_free(bufs[i]);
 		}
-		if (unlikely(nb_rx == 0))
+		/* the writer frees them */
+		if (ctx->capture != NULL)
+			txrx_capture_burst(ctx->capture, bufs, nb_rx, now,
+					&ctx->capture_drops);
+	}
+	txrx_poll_loop_end(&ctx->poll);
+	if (ctx->capture != NULL)
+		txrx_capture_done();
+	return 0;
+}
+
+/*
+ * Allocates the latency histogram and the flow table of a polling lcore,
+ * on its own socket. Lcores that poll no queue get none.
+ */
+static void
+lcore_rx_alloc(unsigned lcore_id)
+{
+	struct lcore_rx_ctx *ctx = &rx_ctx[lcore_id];
+	const int socket = rte_lcore_to_socket_id(lcore_id);
+	char name[RTE_HASH_NAMESIZE];
+	struct rte_hash_parameters hash_params = {
+		.name = name,
+		.entries = FLOW_TABLE_SIZE,
+		.key_len = sizeof(struct flow_key),
+		.hash_func = rte_hash_crc,
+		.hash_func_init_val = 0,
+		.socket_id = socket,
+	};
+
+	ctx->lat = rte_zmalloc_socket("rx_lat", sizeof(struct txrx_lat_hist),
+			RTE_CACHE_LINE_SIZE, socket);
+	if (ctx->lat == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate latency histogram\n");
+
+	snprintf(name, sizeof(name), "rx_flows_%u", lcore_id);
+	ctx->flow_hash = rte_hash_create(&hash_params);
+	ctx->flows = rte_zmalloc_socket("rx_flows",
+			FLOW_TABLE_SIZE * sizeof(struct rx_flow),
+			RTE_CACHE_LINE_SIZE, socket);
+	if (ctx->flow_hash == NULL || ctx->flows == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create flow table\n");
+	if (flow_top_n != 0) {
+		flow_last[lcore_id] = calloc(FLOW_TABLE_SIZE,
+				sizeof(struct flow_count));
+		if (flow_last[lcore_id] == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate flow counts\n");
+	}
+}
+
+static void
+print_usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [--top-flows N] [common options]\n"
+		"    [idle options] [checksum options] [capture options]\n"
+		"    [verify options]\n"
+		"  --top-flows N: count packets and bytes of every flow and\n"
+		"      print the N largest, every interval and at the end,\n"
+		"      1-%u (default: only probes are tracked)\n", prgname,
+		FLOW_TOP_MAX);
+	txrx_conf_usage();
+	txrx_idle_usage();
+	txrx_cksum_usage();
+	txrx_capture_usage();
+	txrx_verify_usage();
+}
+
+#define CMD_LINE_OPT_TOP_FLOWS "top-flows"
+
+enum {
+	/* long options mapped to a short option */
+	CMD_LINE_OPT_MIN_NUM = 256,
+	CMD_LINE_OPT_TOP_FLOWS_NUM,
+};
+
+static const char short_options[] = "";
+
+static const struct option lgopts[] = {
+	{ CMD_LINE_OPT_TOP_FLOWS, required_argument, NULL,
+		CMD_LINE_OPT_TOP_FLOWS_NUM },
+	TXRX_CONF_LGOPTS,
+	TXRX_IDLE_LGOPTS,
+	TXRX_CKSUM_LGOPTS,
+	TXRX_CAPTURE_LGOPTS,
+	TXRX_VERIFY_LGOPTS,
+	{ NULL, 0, 0, 0 }
+};
+
+static int
+parse_args(int argc, char **argv)
+{
+	char *prgname = argv[0];
+	unsigned long n;
+	int opt, ret;
+
+	while ((opt = getopt_long(argc, argv, short_options,
+			lgopts, NULL)) != EOF) {
+		if (opt == CMD_LINE_OPT_TOP_FLOWS_NUM) {
+			if (txrx_parse_uint(optarg, 1, FLOW_TOP_MAX, &n) != 0) {
+				printf("invalid flow count %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			flow_top_n = n;
 			continue;
-		*/
-		for(int i=0;i< nb_rx;i++)
-			rte_pktmbuf_free(bufs[i]);
+		}
+		ret = txrx_conf_parse(opt, optarg);
+		if (ret > 0)
+			ret = txrx_idle_parse(opt, optarg);
+		if (ret > 0)
+			ret = txrx_cksum_parse(opt, optarg);
+		if (ret > 0)
+			ret = txrx_capture_parse(opt, optarg);
+		if (ret > 0)
+			ret = txrx_verify_parse(opt, optarg);
+		if (ret != 0) {
+			print_usage(prgname);
+			return -1;
+		}
 	}
-	
-	
-	//fclose(fp);
+
+	if (optind >= 0)
+		argv[optind-1] = prgname;
+
+	optind = 1; /* reset getopt lib */
+	return 0;
 }
 
 /*
@@ -229,7 +826,10 @@ int
 main(int argc, char *argv[])
 {
 	struct rte_mempool *mbuf_pool;
-	unsigned nb_ports;
+	unsigned nb_ports, nb_slaves;
+	unsigned lcore_id;
+	uint16_t nb_rxq;
+	uint16_t q;
 	uint8_t portid;
 
 	/* Initialize the Environment Abstraction Layer (EAL). */
@@ -240,30 +840,94 @@ main(int argc, char *argv[])
 	argc -= ret;
 	argv += ret;
 
-	/* Check that there is an even number of ports to send/receive on. */
-	nb_ports = rte_eth_dev_count();
-	printf("\nNnumber of Ports: %d\n", nb_ports);
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * 64,
-		MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	txrx_time_init();
+	txrx_signals_init();
 
-	if (mbuf_pool == NULL)
-		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+	ret = parse_args(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Invalid receiver arguments\n");
 
-	/* Initialize all ports. */
-	for (portid = 0; portid < nb_ports; portid++)
-		if (port_init(portid, mbuf_pool) != 0)
-			rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n",
-					portid);
+	nb_ports = rte_eth_dev_count();
+	printf("\nNnumber of Ports: %d\n", nb_ports);
+	portid = txrx_conf.port;
+	if (portid >= nb_ports)
+		rte_exit(EXIT_FAILURE, "Port %u not available\n", portid);
 
-	if (rte_lcore_count() > 1)
-		printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+	/*
+	 * One RX queue per slave lcore (or --queues) while the master
+	 * reports, the EAL core list sets the count. A lone master polls
+	 * queue 0 itself. A capture takes a slave lcore for its writer.
+	 */
+	nb_slaves = rte_lcore_count() - 1;
+	if (txrx_capture_conf.path != NULL) {
+		if (nb_slaves < 2)
+			rte_exit(EXIT_FAILURE, "--capture needs an lcore of its "
+					"own, 3 lcores at least\n");
+		nb_slaves--;
+	}
+	nb_rxq = txrx_conf_queues(nb_slaves != 0 ? nb_slaves : 1);
 
-	/* Call lcore_main on the master core only. */
-	lcore_main();
+	/*
+	 * The mbufs live on the NIC's socket, where its DMA writes them. A
+	 * capture keeps up to a ring of them per queue on their way to disk.
+	 */
+	mbuf_pool = txrx_socket_pool("MBUF_POOL", txrx_port_socket(portid),
+		txrx_conf_mbufs(RTE_MAX(NUM_MBUFS, nb_rxq *
+			(txrx_conf.rx_ring_size + txrx_conf.mbuf_cache +
+			 txrx_conf.burst +
+			 (txrx_capture_conf.path != NULL ? CAPTURE_RING_SIZE : 0)))),
+		txrx_conf.mbuf_cache, RTE_MBUF_DEFAULT_BUF_SIZE);
+
+	/* Initialize the RX port. */
+	if (port_init(portid, mbuf_pool, nb_rxq) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n", portid);
+
+	printf("\n%u RX queue(s), one polling lcore each.\n", nb_rxq);
+
+	if (rte_lcore_count() > 1) {
+		unsigned lcores[RTE_MAX_LCORE];
+		const unsigned n = txrx_pick_lcores(txrx_port_socket(portid),
+				lcores);
+
+		/*
+		 * The slaves poll the queues, those on the port's socket
+		 * first, and the master reports. The capture writer gets the
+		 * last slave, away from the port if any is.
+		 */
+		if (txrx_capture_conf.path != NULL)
+			txrx_capture_init(lcores[n - 1], nb_rxq);
+		for (q = 0; q < nb_rxq; q++) {
+			lcore_id = lcores[q];
+			rx_ctx[lcore_id].port = portid;
+			rx_ctx[lcore_id].queue = q;
+			rx_ctx[lcore_id].enabled = 1;
+			lcore_rx_alloc(lcore_id);
+			if (txrx_capture_conf.path != NULL)
+				rx_ctx[lcore_id].capture =
+					txrx_capture_ring(lcore_id);
+			rte_eal_remote_launch(lcore_rx, &rx_ctx[lcore_id], lcore_id);
+		}
+		if (txrx_capture_conf.path != NULL)
+			rte_eal_remote_launch(txrx_capture_lcore, NULL,
+					lcores[n - 1]);
+		report_loop(portid);
+		rte_eal_mp_wait_lcore();
+	} else {
+		pthread_t report_tid;
+
+		lcore_id = rte_get_master_lcore();
+		rx_ctx[lcore_id].port = portid;
+		rx_ctx[lcore_id].queue = 0;
+		rx_ctx[lcore_id].enabled = 1;
+		lcore_rx_alloc(lcore_id);
+		if (txrx_stats_thread_start(&report_tid, report_thread,
+				&portid) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot start stats thread\n");
+		lcore_rx(&rx_ctx[lcore_id]);
+		pthread_join(report_tid, NULL);
+	}
+	report_rx_stats(portid);
+	txrx_port_close(portid);
 
 	return 0;
 }
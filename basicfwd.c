@@ -33,56 +33,137 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <getopt.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
+#include <rte_launch.h>
+#include <rte_malloc.h>
+#include <rte_ether.h>
+#include <rte_prefetch.h>
 
-#define RX_RING_SIZE 128
-#define TX_RING_SIZE 512
+#include "txrx_time.h"
+#include "txrx_stats.h"
+#include "txrx_conf.h"
+#include "txrx_numa.h"
+#include "txrx_poll.h"
+#include "txrx_idle.h"
 
+/* Pools get at least this many mbufs unless --mbufs says otherwise. */
 #define NUM_MBUFS 8191
-#define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 32
+
+/* A partly filled TX buffer is sent after at most this long. */
+#define BURST_TX_DRAIN_US 100
 
 static const struct rte_eth_conf port_conf_default = {
-	.rxmode = { .max_rx_pkt_len = ETHER_MAX_LEN }
+	.rxmode = {
+		.mq_mode = ETH_MQ_RX_RSS,
+		.max_rx_pkt_len = ETHER_MAX_LEN,
+	},
+	.rx_adv_conf = {
+		.rss_conf = {
+			.rss_key = NULL,
+			.rss_hf = ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP,
+		},
+	},
 };
 
+/* Ports to forward between; 0 means all. */
+static uint32_t enabled_port_mask;
+
+/* Where each enabled port forwards to. */
+static uint8_t fwd_dst_port[RTE_MAX_ETHPORTS];
+static uint8_t fwd_dst_set[RTE_MAX_ETHPORTS];
+
+/*
+ * With --mac-rewrite every forwarded frame gets the TX port's MAC as
+ * source and the MAC of the peer behind the TX port as destination,
+ * 02:00:00:00:00:<port> unless given with --peer-mac.
+ */
+static int mac_rewrite;
+static struct ether_addr port_mac[RTE_MAX_ETHPORTS];
+static struct ether_addr peer_mac[RTE_MAX_ETHPORTS];
+
+static uint8_t fwd_ports[RTE_MAX_ETHPORTS];
+static unsigned nb_fwd_ports;
+
+struct port_counters {
+	uint64_t rx_pkts;
+	uint64_t rx_bytes;
+	uint64_t tx_pkts;
+	uint64_t tx_dropped;	/* TX queue full when the buffer was flushed */
+};
+
+/*
+ * Per-lcore forwarding context. A forwarding lcore polls its own RX queue
+ * on every enabled port and transmits on its own TX queue, through one TX
+ * buffer per destination port, so no queue is shared between lcores.
+ */
+struct lcore_fwd_ctx {
+	uint8_t enabled;
+	uint16_t queue;
+	struct rte_eth_dev_tx_buffer *tx_buf[RTE_MAX_ETHPORTS];
+	struct port_counters port[RTE_MAX_ETHPORTS];
+	struct txrx_poll_lcore poll;	/* with TXRX_POLL_STATS only */
+	struct txrx_idle idle;
+	unsigned epoch;			/* warm-up epoch of the counters */
+} __rte_cache_aligned;
+
+static struct lcore_fwd_ctx fwd_ctx[RTE_MAX_LCORE];
 
 /*
  * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * coming from the mbuf_pool passed as a parameter. Every forwarding lcore
+ * gets one RX and one TX queue; RSS spreads flows over the RX queues.
  */
 static inline int
-port_init(uint8_t port, struct rte_mempool *mbuf_pool)
+port_init(uint8_t port, struct rte_mempool *mbuf_pool, uint16_t nb_queues)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	struct rte_eth_dev_info dev_info;
+	const uint16_t rx_rings = nb_queues, tx_rings = nb_queues;
 	int retval;
 	uint16_t q;
 
 	if (port >= rte_eth_dev_count())
 		return -1;
 
+	rte_eth_dev_info_get(port, &dev_info);
+	if (rx_rings > dev_info.max_rx_queues ||
+			tx_rings > dev_info.max_tx_queues) {
+		printf("Port %u supports %u RX and %u TX queues, %u requested\n",
+				(unsigned)port, dev_info.max_rx_queues,
+				dev_info.max_tx_queues, (unsigned)nb_queues);
+		return -1;
+	}
+
+	/* Only hash on what the device can hash on, RSS is pointless for 1 queue. */
+	port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
+	if (rx_rings == 1 || port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+		port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+	port_conf.intr_conf.rxq = txrx_idle_intr();
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
 		return retval;
 
-	/* Allocate and set up 1 RX queue per Ethernet port. */
+	/* Allocate and set up 1 RX queue per forwarding lcore. */
 	for (q = 0; q < rx_rings; q++) {
-		retval = rte_eth_rx_queue_setup(port, q, RX_RING_SIZE,
+		retval = rte_eth_rx_queue_setup(port, q, txrx_conf.rx_ring_size,
 				rte_eth_dev_socket_id(port), NULL, mbuf_pool);
 		if (retval < 0)
 			return retval;
 	}
 
-	/* Allocate and set up 1 TX queue per Ethernet port. */
+	/* Allocate and set up 1 TX queue per forwarding lcore. */
 	for (q = 0; q < tx_rings; q++) {
-		retval = rte_eth_tx_queue_setup(port, q, TX_RING_SIZE,
+		retval = rte_eth_tx_queue_setup(port, q, txrx_conf.tx_ring_size,
 				rte_eth_dev_socket_id(port), NULL);
 		if (retval < 0)
 			return retval;
@@ -102,6 +183,7 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 			addr.addr_bytes[0], addr.addr_bytes[1],
 			addr.addr_bytes[2], addr.addr_bytes[3],
 			addr.addr_bytes[4], addr.addr_bytes[5]);
+	port_mac[port] = addr;
 
 	/* Enable RX in promiscuous mode for the Ethernet device. */
 	rte_eth_promiscuous_enable(port);
@@ -109,64 +191,486 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 	return 0;
 }
 
+static inline void
+rewrite_mac(struct rte_mbuf *m, uint8_t dst_port)
+{
+	struct ether_hdr *eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+
+	ether_addr_copy(&peer_mac[dst_port], &eth->d_addr);
+	ether_addr_copy(&port_mac[dst_port], &eth->s_addr);
+}
+
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * Drops what the lcore counted during the warm-up. Its TX buffers are
+ * left alone, what they hold is sent and counted after it.
  */
-static __attribute__((noreturn)) void
-lcore_main(void)
+static void
+lcore_fwd_restart(struct lcore_fwd_ctx *ctx)
 {
-	const uint8_t nb_ports = rte_eth_dev_count();
-	uint8_t port;
+	memset(ctx->port, 0, sizeof(ctx->port));
+	txrx_poll_reset(&ctx->poll);
+	txrx_idle_reset(&ctx->idle);
+	txrx_epoch_ack(&ctx->epoch);
+}
 
-	/*
-	 * Check that the port is on the same NUMA node as the polling thread
-	 * for best performance.
-	 */
-	for (port = 0; port < nb_ports; port++)
-		if (rte_eth_dev_socket_id(port) > 0 &&
-				rte_eth_dev_socket_id(port) !=
-						(int)rte_socket_id())
-			printf("WARNING, port %u is on remote NUMA node to "
-					"polling thread.\n\tPerformance will "
-					"not be optimal.\n", port);
-
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-			rte_lcore_id());
-	
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-	/* on the current machine, mellanox NIC is on port 0, so we enforce the port=0 here*/
-	port=0;
-	FILE *fp;
-	fp = fopen("/tmp/dump.txt", "w");
-	uint16_t count=0;
-	/* Run until the application is quit or killed. */
-	for (;;) {
-
-		/* Get burst of RX packets */
-		struct rte_mbuf *bufs[BURST_SIZE];
-		/*const uint16_t*/
-		/* pull mode devices, so most the time nb_rx can be 0 */ 
-		uint16_t nb_rx = rte_eth_rx_burst(port, 0, bufs, BURST_SIZE);
-		count=nb_rx+count;
-		if(nb_rx>0)
-			printf("%" PRIu16 "\n", count);
-		//printf("nb_rx: %d\n", nb_rx);
-		/*if (fp != NULL){
- 			//fprintf(fp, "Port number %d \n", port);
-			for(int i=0;i < nb_rx;i++){
- 				rte_pktmbuf_dump(fp, bufs[i], sizeof(bufs[i]));
-				count++;
+/*
+ * The forwarding loop. Received packets go into the TX buffer of their
+ * destination port, which sends a full burst by itself; every
+ * BURST_TX_DRAIN_US the buffers are flushed so that a trickle of packets
+ * is not held back.
+ */
+static int
+lcore_fwd(void *arg)
+{
+	struct lcore_fwd_ctx *ctx = arg;
+	const uint16_t queue = ctx->queue;
+	const uint16_t burst = txrx_conf.burst;
+	const uint64_t drain_tsc = txrx_ns_to_cycles(BURST_TX_DRAIN_US * 1000ULL);
+	uint64_t prev_tsc = 0;
+	unsigned i;
+
+	txrx_idle_init(&ctx->idle);
+	for (i = 0; i < nb_fwd_ports; i++) {
+		txrx_check_lcore_socket(rte_lcore_id(), fwd_ports[i]);
+		txrx_idle_add_queue(&ctx->idle, fwd_ports[i], queue);
+	}
+
+	printf("\nCore %u forwarding packets on queue %u. [Ctrl+C to quit]\n",
+			rte_lcore_id(), queue);
+
+	/* Run until --duration or --count is up or the application is killed. */
+	txrx_wait_go();
+	txrx_poll_loop_begin(&ctx->poll);
+	while (!txrx_quit) {
+		const uint64_t cur_tsc = rte_rdtsc();
+		unsigned nb_round = 0;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_fwd_restart(ctx);
+
+		if (unlikely(cur_tsc - prev_tsc > drain_tsc)) {
+			for (i = 0; i < nb_fwd_ports; i++) {
+				const uint8_t port = fwd_ports[i];
+
+				ctx->port[port].tx_pkts += rte_eth_tx_buffer_flush(
+						port, queue, ctx->tx_buf[port]);
+			}
+			prev_tsc = cur_tsc;
+		}
+
+		for (i = 0; i < nb_fwd_ports; i++) {
+			const uint8_t port = fwd_ports[i];
+			const uint8_t dst_port = fwd_dst_port[port];
+			struct rte_eth_dev_tx_buffer *buf = ctx->tx_buf[dst_port];
+			struct rte_mbuf *bufs[MAX_BURST_SIZE];
+			uint64_t poll_tsc;
+			uint16_t nb_rx, j;
+
+			/* pull mode devices, so most the time nb_rx can be 0 */
+			poll_tsc = txrx_poll_start();
+			nb_rx = rte_eth_rx_burst(port, queue, bufs, burst);
+			txrx_poll_end(&ctx->poll.rx, poll_tsc, nb_rx, burst);
+			if (nb_rx == 0)
+				continue;
+			/* a probe is only looked at until it is forwarded */
+			if (unlikely(nb_round == 0 &&
+					txrx_idle_slept(&ctx->idle)))
+				txrx_idle_woke(&ctx->idle, bufs[0]);
+			nb_round += nb_rx;
+			ctx->port[port].rx_pkts += nb_rx;
+			for (j = 0; j < nb_rx; j++) {
+				rte_prefetch0(rte_pktmbuf_mtod(bufs[j], void *));
+				ctx->port[port].rx_bytes += rte_pktmbuf_pkt_len(bufs[j]);
+			}
+			for (j = 0; j < nb_rx; j++) {
+				if (mac_rewrite)
+					rewrite_mac(bufs[j], dst_port);
+				ctx->port[dst_port].tx_pkts += rte_eth_tx_buffer(
+						dst_port, queue, buf, bufs[j]);
+			}
+		}
+
+		/* Nothing may sit in a TX buffer while the lcore sleeps. */
+		if (nb_round == 0 && txrx_idle_conf.mode != IDLE_POLL) {
+			for (i = 0; i < nb_fwd_ports; i++) {
+				const uint8_t port = fwd_ports[i];
+
+				ctx->port[port].tx_pkts += rte_eth_tx_buffer_flush(
+						port, queue, ctx->tx_buf[port]);
+			}
+		}
+		txrx_idle_poll(&ctx->idle, nb_round);
+	}
+	txrx_poll_loop_end(&ctx->poll);
+
+	for (i = 0; i < nb_fwd_ports; i++) {
+		const uint8_t port = fwd_ports[i];
+
+		ctx->port[port].tx_pkts += rte_eth_tx_buffer_flush(port, queue,
+				ctx->tx_buf[port]);
+	}
+	return 0;
+}
+
+/* Sums the counters of one port over the forwarding lcores. */
+static void
+sample_port_stats(uint8_t port, struct txrx_sample *sample)
+{
+	unsigned lcore_id;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->tsc = rte_rdtsc();
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_fwd_ctx *ctx = &fwd_ctx[lcore_id];
+
+		if (!ctx->enabled)
+			continue;
+		sample->pkts += ctx->port[port].rx_pkts;
+		sample->bytes += ctx->port[port].rx_bytes;
+		sample->drops += ctx->port[port].tx_dropped;
+	}
+	rte_eth_stats_get(port, &sample->eth);
+}
+
+/* Packets received on all ports so far, for --count. */
+static uint64_t
+count_fwd_pkts(void)
+{
+	uint64_t pkts = 0;
+	unsigned lcore_id, i;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_fwd_ctx *ctx = &fwd_ctx[lcore_id];
+
+		if (!ctx->enabled)
+			continue;
+		for (i = 0; i < nb_fwd_ports; i++)
+			pkts += ctx->port[fwd_ports[i]].rx_pkts;
+	}
+	return pkts;
+}
+
+/*
+ * The stats reporter: every STATS_INTERVAL_MS one block per port, with
+ * the rate received on it and the TX drops of the packets sent out of
+ * it.
+ */
+static void
+report_loop(void)
+{
+	const uint64_t interval = txrx_ns_to_cycles(STATS_INTERVAL_MS * 1000000ULL);
+	static struct txrx_sample prev[RTE_MAX_ETHPORTS], cur[RTE_MAX_ETHPORTS];
+	static struct txrx_xstats xstats[RTE_MAX_ETHPORTS];
+	struct txrx_run run;
+	uint64_t start_tsc;
+	unsigned lcore_id, nb_lcores = 0;
+	unsigned i;
+	int stop;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (fwd_ctx[lcore_id].enabled)
+			nb_lcores++;
+	}
+	for (i = 0; i < nb_fwd_ports; i++)
+		txrx_xstats_init(&xstats[i], fwd_ports[i]);
+	txrx_run_start(&run, nb_lcores, count_fwd_pkts);
+	for (i = 0; i < nb_fwd_ports; i++)
+		sample_port_stats(fwd_ports[i], &prev[i]);
+	start_tsc = prev[0].tsc;
+	do {
+		stop = txrx_run_wait(&run, prev[0].tsc + interval);
+		if (txrx_run_warm(&run)) {
+			for (i = 0; i < nb_fwd_ports; i++) {
+				txrx_port_stats_reset(fwd_ports[i], &xstats[i]);
+				sample_port_stats(fwd_ports[i], &prev[i]);
+			}
+			continue;
+		}
+		for (i = 0; i < nb_fwd_ports; i++) {
+			char what[16];
+
+			sample_port_stats(fwd_ports[i], &cur[i]);
+			snprintf(what, sizeof(what), "port %u RX", fwd_ports[i]);
+			txrx_print_interval(what, start_tsc, &prev[i], &cur[i]);
+			txrx_xstats_print(&xstats[i], fwd_ports[i]);
+			prev[i] = cur[i];
+		}
+	} while (!stop);
+	for (i = 0; i < nb_fwd_ports; i++)
+		txrx_xstats_free(&xstats[i]);
+}
+
+/* Per-port totals once the forwarding lcores are done, and the summary. */
+static void
+report_totals(unsigned nb_lcores)
+{
+	const uint64_t cycles = rte_rdtsc() - txrx_measure_tsc;
+	struct port_counters total = { 0 };
+	unsigned lcore_id, i;
+
+	for (i = 0; i < nb_fwd_ports; i++) {
+		const uint8_t port = fwd_ports[i];
+		struct port_counters sum = { 0 };
+
+		RTE_LCORE_FOREACH(lcore_id) {
+			const struct lcore_fwd_ctx *ctx = &fwd_ctx[lcore_id];
+
+			if (!ctx->enabled)
+				continue;
+			sum.rx_pkts += ctx->port[port].rx_pkts;
+			sum.rx_bytes += ctx->port[port].rx_bytes;
+			sum.tx_pkts += ctx->port[port].tx_pkts;
+			sum.tx_dropped += ctx->port[port].tx_dropped;
+		}
+		printf("port %u: rx %" PRIu64 " tx %" PRIu64 " tx dropped %"
+				PRIu64 "\n", port, sum.rx_pkts, sum.tx_pkts,
+				sum.tx_dropped);
+		total.rx_pkts += sum.rx_pkts;
+		total.rx_bytes += sum.rx_bytes;
+		total.tx_pkts += sum.tx_pkts;
+		total.tx_dropped += sum.tx_dropped;
+	}
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (!fwd_ctx[lcore_id].enabled)
+			continue;
+		txrx_poll_print(lcore_id, &fwd_ctx[lcore_id].poll,
+				txrx_conf.burst);
+		txrx_idle_print(lcore_id, &fwd_ctx[lcore_id].idle, cycles);
+	}
+	/* rates are of what came in; drops tell what did not get out */
+	txrx_print_rate("received", total.rx_pkts, total.rx_bytes, cycles);
+	txrx_print_result("fwd", nb_lcores, total.rx_pkts, total.rx_bytes,
+			total.tx_dropped, cycles);
+}
+
+static void *
+report_thread(__attribute__((unused)) void *arg)
+{
+	report_loop();
+	return NULL;
+}
+
+static void
+print_usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [-p PORTMASK] [--pair A,B]...\n"
+		"    [--mac-rewrite] [--peer-mac PORT,MAC]... [common options]\n"
+		"    [idle options]\n"
+		"  -p PORTMASK: hexadecimal bitmask of ports to forward between\n"
+		"      (default: all)\n"
+		"  --pair A,B: forward A to B and B to A; ports not paired this\n"
+		"      way pair up in order, a last odd port forwards to itself\n"
+		"  --mac-rewrite: set source MAC to the TX port's, destination\n"
+		"      to its peer's\n"
+		"  --peer-mac PORT,MAC: peer MAC behind PORT\n"
+		"      (default 02:00:00:00:00:PORT)\n"
+		"  --port P adds port P to the port mask\n",
+		prgname);
+	txrx_conf_usage();
+	txrx_idle_usage();
+}
+
+static int
+parse_portmask(const char *portmask)
+{
+	char *end = NULL;
+	unsigned long pm;
+
+	pm = strtoul(portmask, &end, 16);
+	if (portmask[0] == '\0' || end == NULL || *end != '\0' || pm == 0)
+		return -1;
+	return pm;
+}
+
+static int
+parse_mac(const char *arg, struct ether_addr *addr)
+{
+	uint8_t *b = addr->addr_bytes;
+	char c;
+
+	if (sscanf(arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c",
+			&b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &c) != 6)
+		return -1;
+	return 0;
+}
+
+/* "A,B", two distinct ports not paired otherwise yet */
+static int
+parse_pair(const char *arg)
+{
+	unsigned a, b;
+	char c;
+
+	if (sscanf(arg, "%u,%u%c", &a, &b, &c) != 2 ||
+			a >= RTE_MAX_ETHPORTS || b >= RTE_MAX_ETHPORTS ||
+			a == b)
+		return -1;
+	if (fwd_dst_set[a] && fwd_dst_port[a] == b)
+		return 0;	/* given twice */
+	if (fwd_dst_set[a] || fwd_dst_set[b]) {
+		const unsigned p = fwd_dst_set[a] ? a : b;
+
+		printf("port %u is already paired with %u\n", p,
+				fwd_dst_port[p]);
+		return -1;
+	}
+	fwd_dst_port[a] = b;
+	fwd_dst_port[b] = a;
+	fwd_dst_set[a] = fwd_dst_set[b] = 1;
+	return 0;
+}
+
+/* "PORT,MAC" */
+static int
+parse_peer_mac(const char *arg)
+{
+	unsigned long port;
+	char *end;
+
+	port = strtoul(arg, &end, 10);
+	if (end == arg || *end != ',' || port >= RTE_MAX_ETHPORTS)
+		return -1;
+	return parse_mac(end + 1, &peer_mac[port]);
+}
+
+#define CMD_LINE_OPT_PAIR "pair"
+#define CMD_LINE_OPT_MAC_REWRITE "mac-rewrite"
+#define CMD_LINE_OPT_PEER_MAC "peer-mac"
+
+enum {
+	/* long options mapped to a short option */
+
+	/* first long only option value must be >= 256, so that we won't
+	 * conflict with short options */
+	CMD_LINE_OPT_MIN_NUM = 256,
+	CMD_LINE_OPT_PAIR_NUM,
+	CMD_LINE_OPT_MAC_REWRITE_NUM,
+	CMD_LINE_OPT_PEER_MAC_NUM,
+};
+
+static const char short_options[] = "p:";
+
+static const struct option lgopts[] = {
+	{ CMD_LINE_OPT_PAIR, required_argument, NULL, CMD_LINE_OPT_PAIR_NUM },
+	{ CMD_LINE_OPT_MAC_REWRITE, no_argument, NULL, CMD_LINE_OPT_MAC_REWRITE_NUM },
+	{ CMD_LINE_OPT_PEER_MAC, required_argument, NULL, CMD_LINE_OPT_PEER_MAC_NUM },
+	TXRX_CONF_LGOPTS,
+	TXRX_IDLE_LGOPTS,
+	{ NULL, 0, 0, 0 }
+};
+
+static int
+parse_args(int argc, char **argv)
+{
+	char *prgname = argv[0];
+	int opt, ret;
+
+	while ((opt = getopt_long(argc, argv, short_options,
+			lgopts, NULL)) != EOF) {
+		switch (opt) {
+		case 'p':
+			ret = parse_portmask(optarg);
+			if (ret < 0) {
+				printf("invalid portmask %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			enabled_port_mask = ret;
+			break;
+		case CMD_LINE_OPT_PAIR_NUM:
+			if (parse_pair(optarg) < 0) {
+				printf("invalid port pair %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_MAC_REWRITE_NUM:
+			mac_rewrite = 1;
+			break;
+		case CMD_LINE_OPT_PEER_MAC_NUM:
+			if (parse_peer_mac(optarg) < 0) {
+				printf("invalid peer MAC %s\n", optarg);
+				print_usage(prgname);
+				return -1;
 			}
-			printf("%" PRIu16 "\n",count);
-		}*/
-		//if (unlikely(nb_rx == 0))
-		//	continue;
-		/*for(int i=0;i< nb_rx;i++)
-			rte_pktmbuf_free(bufs[i]);*/
+			break;
+		default:
+			ret = txrx_conf_parse(opt, optarg);
+			if (ret > 0)
+				ret = txrx_idle_parse(opt, optarg);
+			if (ret != 0) {
+				print_usage(prgname);
+				return -1;
+			}
+			if (opt == TXRX_OPT_PORT_NUM)
+				enabled_port_mask |= 1U << txrx_conf.port;
+			break;
+		}
+	}
+
+	if (optind >= 0)
+		argv[optind-1] = prgname;
+
+	optind = 1; /* reset getopt lib */
+	return 0;
+}
+
+/*
+ * Collects the enabled ports and completes the forwarding table: ports
+ * without an explicit --pair pair up in order, like l2fwd does.
+ */
+static void
+setup_fwd_ports(unsigned nb_ports)
+{
+	int last = -1;
+	unsigned i;
+
+	if (enabled_port_mask == 0)
+		enabled_port_mask = nb_ports >= 32 ? UINT32_MAX :
+				(1U << nb_ports) - 1;
+
+	for (i = 0; i < RTE_MAX_ETHPORTS; i++) {
+		if ((enabled_port_mask & (1U << i)) == 0) {
+			if (fwd_dst_set[i])
+				rte_exit(EXIT_FAILURE, "port %u is paired but "
+						"not enabled\n", i);
+			continue;
+		}
+		if (i >= nb_ports)
+			rte_exit(EXIT_FAILURE, "port %u is not available\n", i);
+		if (fwd_dst_set[i] &&
+				(enabled_port_mask & (1U << fwd_dst_port[i])) == 0)
+			rte_exit(EXIT_FAILURE, "port %u is paired with "
+					"disabled port %u\n", i, fwd_dst_port[i]);
+		fwd_ports[nb_fwd_ports++] = i;
+		if (fwd_dst_set[i])
+			continue;
+		if (last < 0) {
+			last = i;
+		} else {
+			fwd_dst_port[last] = i;
+			fwd_dst_port[i] = last;
+			last = -1;
+		}
+	}
+	if (nb_fwd_ports == 0)
+		rte_exit(EXIT_FAILURE, "No port to forward on\n");
+	if (last >= 0) {
+		printf("Port %d is unpaired, it forwards to itself\n", last);
+		fwd_dst_port[last] = last;
+	}
+
+	for (i = 0; i < nb_fwd_ports; i++) {
+		const uint8_t port = fwd_ports[i];
+		static const struct ether_addr zero_mac;
+
+		if (memcmp(&peer_mac[port], &zero_mac, sizeof(zero_mac)) == 0) {
+			peer_mac[port].addr_bytes[0] = 0x02;
+			peer_mac[port].addr_bytes[5] = port;
+		}
+		printf("Forwarding port %u -> port %u\n", port,
+				fwd_dst_port[port]);
 	}
-	fclose(fp);
 }
 
 /*
@@ -177,8 +681,14 @@ int
 main(int argc, char *argv[])
 {
 	struct rte_mempool *mbuf_pool;
+	unsigned socket_ports[RTE_MAX_NUMA_NODES] = { 0 };
+	unsigned lcores[RTE_MAX_LCORE];
 	unsigned nb_ports;
-	uint8_t portid;
+	unsigned nb_lcores;
+	unsigned lcore_id;
+	uint16_t nb_queues;
+	uint16_t q;
+	unsigned i;
 
 	/* Initialize the Environment Abstraction Layer (EAL). */
 	int ret = rte_eal_init(argc, argv);
@@ -188,30 +698,104 @@ main(int argc, char *argv[])
 	argc -= ret;
 	argv += ret;
 
-	/* Check that there is an even number of ports to send/receive on. */
+	txrx_time_init();
+	txrx_signals_init();
+
+	ret = parse_args(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Invalid forwarder arguments\n");
+
 	nb_ports = rte_eth_dev_count();
 	printf("\nNnumber of Ports: %d\n", nb_ports);
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
+	if (nb_ports == 0)
+		rte_exit(EXIT_FAILURE, "No Ethernet ports - bye\n");
+	setup_fwd_ports(nb_ports);
 
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-		MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	/*
+	 * One queue pair per slave lcore (or --queues) on every port while
+	 * the master reports, the EAL core list sets the count. A lone master
+	 * forwards itself.
+	 */
+	nb_lcores = rte_lcore_count();
+	nb_queues = txrx_conf_queues(nb_lcores > 1 ? nb_lcores - 1 : 1);
 
-	if (mbuf_pool == NULL)
-		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+	/* How many forwarding ports each socket has. */
+	for (i = 0; i < nb_fwd_ports; i++)
+		socket_ports[txrx_port_socket(fwd_ports[i])]++;
 
-	/* Initialize all ports. */
-	for (portid = 0; portid < nb_ports; portid++)
-		if (port_init(portid, mbuf_pool) != 0)
+	/*
+	 * Initialize the forwarding ports. Each RX queue fills mbufs from
+	 * the pool on its NIC's socket, sized for the queues of the ports
+	 * there. A forwarded mbuf goes back to the pool it came from.
+	 */
+	for (i = 0; i < nb_fwd_ports; i++) {
+		const unsigned socket = txrx_port_socket(fwd_ports[i]);
+
+		mbuf_pool = txrx_socket_pool("MBUF_POOL", socket,
+			txrx_conf_mbufs(RTE_MAX(NUM_MBUFS,
+				socket_ports[socket] * nb_queues *
+				(txrx_conf.rx_ring_size +
+				 txrx_conf.tx_ring_size + txrx_conf.burst) +
+				nb_lcores * txrx_conf.mbuf_cache)),
+			txrx_conf.mbuf_cache, RTE_MBUF_DEFAULT_BUF_SIZE);
+		if (port_init(fwd_ports[i], mbuf_pool, nb_queues) != 0)
 			rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n",
-					portid);
+					fwd_ports[i]);
+	}
+
+	/*
+	 * The forwarding lcores, from the socket of the first port first,
+	 * and a TX buffer per lcore and port.
+	 */
+	if (nb_lcores > 1)
+		txrx_pick_lcores(txrx_port_socket(fwd_ports[0]), lcores);
+	else
+		lcores[0] = rte_get_master_lcore();
+	for (q = 0; q < nb_queues; q++) {
+		struct lcore_fwd_ctx *ctx = &fwd_ctx[lcores[q]];
 
-	if (rte_lcore_count() > 1)
-		printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+		ctx->enabled = 1;
+		ctx->queue = q;
+		for (i = 0; i < nb_fwd_ports; i++) {
+			const uint8_t port = fwd_ports[i];
 
-	/* Call lcore_main on the master core only. */
-	lcore_main();
+			ctx->tx_buf[port] = rte_zmalloc_socket("tx_buffer",
+					RTE_ETH_TX_BUFFER_SIZE(txrx_conf.burst), 0,
+					rte_eth_dev_socket_id(port));
+			if (ctx->tx_buf[port] == NULL)
+				rte_exit(EXIT_FAILURE, "Cannot allocate TX "
+						"buffer for port %u\n", port);
+			rte_eth_tx_buffer_init(ctx->tx_buf[port], txrx_conf.burst);
+			ret = rte_eth_tx_buffer_set_err_callback(ctx->tx_buf[port],
+					rte_eth_tx_buffer_count_callback,
+					&ctx->port[port].tx_dropped);
+			if (ret < 0)
+				rte_exit(EXIT_FAILURE, "Cannot set error callback "
+						"for TX buffer of port %u\n", port);
+		}
+	}
+
+	if (nb_lcores > 1) {
+		/* The slaves forward, the master reports. */
+		RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+			if (fwd_ctx[lcore_id].enabled)
+				rte_eal_remote_launch(lcore_fwd,
+						&fwd_ctx[lcore_id], lcore_id);
+		}
+		report_loop();
+		rte_eal_mp_wait_lcore();
+	} else {
+		pthread_t report_tid;
+
+		if (txrx_stats_thread_start(&report_tid, report_thread,
+				NULL) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot start stats thread\n");
+		lcore_fwd(&fwd_ctx[rte_get_master_lcore()]);
+		pthread_join(report_tid, NULL);
+	}
+	report_totals(nb_queues);
+	for (i = 0; i < nb_fwd_ports; i++)
+		txrx_port_close(fwd_ports[i]);
 
 	return 0;
 }
@@ -0,0 +1,141 @@
+#!/bin/bash
+#
+# Parameter sweep of the sender, the receivers and the forwarder against a
+# net_null vdev, so it runs without a NIC: the null PMD swallows whatever
+# is sent and hands out as many packets as are polled. Every point of the
+# sweep is one run of DURATION seconds, and the RESULT line it prints
+# becomes one CSV row or JSON object.
+#
+# usage: ./bench.sh [-f csv|json] [-o FILE] [-d SECS] [-n] [APP...]
+#   -f      output format (default csv)
+#   -o      output file (default stdout)
+#   -d      seconds per point (default 5)
+#   -n      do not build, use the binaries in build/<app>/
+#   APP     sender, receiver, pipeline and/or basicfwd (default: all)
+#
+# The swept values come from the environment, as space separated lists:
+#   BURSTS (32)  RXDS (128)  TXDS (512)  FRAMES (64)  CORES (2)  CACHES (250)
+# CORES counts EAL lcores, master included. EAL_ARGS is added to the EAL
+# options of every run, e.g. EAL_ARGS="--no-huge -m 1024".
+#
+# example: BURSTS="16 32 64" FRAMES="64 1518" ./bench.sh -f json sender
+
+FORMAT=csv
+OUT=
+DURATION=5
+BUILD=1
+
+while getopts "f:o:d:n" opt; do
+	case $opt in
+	f) FORMAT=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	d) DURATION=$OPTARG ;;
+	n) BUILD=0 ;;
+	*) sed -n '9,15s/^# \?//p' "$0"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+APPS=${*:-sender receiver pipeline basicfwd}
+BURSTS=${BURSTS:-32}
+RXDS=${RXDS:-128}
+TXDS=${TXDS:-512}
+FRAMES=${FRAMES:-64}
+CORES=${CORES:-2}
+CACHES=${CACHES:-250}
+
+case $FORMAT in
+csv|json) ;;
+*) echo "unknown format $FORMAT" >&2; exit 1 ;;
+esac
+
+cd "$(dirname "$0")" || exit 1
+
+if [ $BUILD = 1 ]; then
+	for app in $APPS; do
+		make -s APP=$app O=build/$app >&2 || exit 1
+	done
+fi
+
+# Application options of one point, on top of the common ones.
+app_args() {
+	local app=$1 frame=$2
+
+	case $app in
+	sender) echo "-s $frame --bursts 0" ;;
+	pipeline) echo "--mode pipeline" ;;
+	*) ;;
+	esac
+}
+
+# Prints the RESULT line of one run, nothing if the run failed.
+run_point() {
+	local app=$1 burst=$2 rxd=$3 txd=$4 frame=$5 cores=$6 cache=$7
+
+	# the null PMD's size is the frame without FCS, as mbuf lengths are
+	timeout $((DURATION + 30)) ./build/$app/$app \
+		-l 0-$((cores - 1)) --no-pci --file-prefix bench_$$ \
+		--vdev=net_null0,size=$((frame - 4)) $EAL_ARGS -- \
+		--burst $burst --rxd $rxd --txd $txd --mbuf-cache $cache \
+		--duration $DURATION $(app_args $app $frame) 2>&1 |
+		grep '^RESULT ' | tail -n 1
+}
+
+# key=value pairs of a RESULT line as CSV fields or JSON members.
+emit() {
+	local point=$1 result=$2 sep="" kv
+
+	if [ $FORMAT = csv ]; then
+		echo -n "$point"
+		for kv in ${result#RESULT }; do
+			echo -n ",${kv#*=}"
+		done
+		echo
+		return
+	fi
+	echo -n "{"
+	for kv in $point; do
+		case ${kv%%=*} in
+		app) echo -n "$sep\"${kv%%=*}\":\"${kv#*=}\"" ;;
+		*) echo -n "$sep\"${kv%%=*}\":${kv#*=}" ;;
+		esac
+		sep=","
+	done
+	for kv in ${result#RESULT }; do
+		case ${kv%%=*} in
+		role) echo -n ",\"${kv%%=*}\":\"${kv#*=}\"" ;;
+		*) echo -n ",\"${kv%%=*}\":${kv#*=}" ;;
+		esac
+	done
+	echo "}"
+}
+
+[ -n "$OUT" ] && exec > "$OUT"
+
+[ $FORMAT = csv ] && echo "app,burst,rxd,txd,frame,cores,mbuf_cache,role,lcores,secs,pkts,bytes,drops,pps,l2_gbps,l1_gbps,cycles_per_pkt"
+for app in $APPS; do
+for burst in $BURSTS; do
+for rxd in $RXDS; do
+for txd in $TXDS; do
+for frame in $FRAMES; do
+for cores in $CORES; do
+for cache in $CACHES; do
+	echo "$app burst=$burst rxd=$rxd txd=$txd frame=$frame" \
+		"cores=$cores cache=$cache" >&2
+	result=$(run_point $app $burst $rxd $txd $frame $cores $cache)
+	if [ -z "$result" ]; then
+		echo "  no result, skipped" >&2
+		continue
+	fi
+	if [ $FORMAT = csv ]; then
+		emit "$app,$burst,$rxd,$txd,$frame,$cores,$cache" "$result"
+	else
+		emit "app=$app burst=$burst rxd=$rxd txd=$txd frame=$frame cores=$cores mbuf_cache=$cache" "$result"
+	fi
+done
+done
+done
+done
+done
+done
+done
@@ -33,7 +33,10 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <getopt.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
@@ -50,86 +53,551 @@
 #include <rte_ring.h>
 #include <rte_log.h>
 #include <rte_mempool.h>
+#include <rte_malloc.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_hash_crc.h>
+#include <rte_thash.h>
 
-#define RX_RING_SIZE 128
-#define TX_RING_SIZE 512
+#include "txrx_time.h"
+#include "txrx_stats.h"
+#include "txrx_probe.h"
+#include "txrx_conf.h"
+#include "txrx_numa.h"
+#include "txrx_poll.h"
+#include "txrx_cksum.h"
+#include "txrx_verify.h"
 
+/* Pools get at least this many mbufs unless --mbufs says otherwise. */
 #define NUM_MBUFS 8191
-#define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 32
 
-static const char *_MSG_POOL = "MSG_POOL";
-static const char *_SEC_2_PRI = "SEC_2_PRI";
-static const char *_PRI_2_SEC = "PRI_2_SEC";
-const unsigned string_size = 64;
+/* Packets in flight on each ring between two pipeline stages. */
+#define PIPE_RING_SIZE 1024
 
-struct rte_ring *send_ring, *recv_ring;
-struct rte_mempool *message_pool;
-volatile int quit = 0;
+static unsigned pipe_ring_size = PIPE_RING_SIZE;
+
+/*
+ * How an RX lcore spreads its bursts over the workers. Round-robin
+ * balances best but lets packets of one flow overtake each other on
+ * different workers. The flow hashes keep every flow on one worker, in
+ * order: the NIC's RSS hash when the port computed one, else a CRC32
+ * (the SSE4.2 instruction where there is one) or a software Toeplitz
+ * hash, the one RSS NICs use, of the IPv4 5-tuple. With a single RX
+ * queue, on virtual devices or NICs without RSS, the RX lcore is then a
+ * software RSS dispatcher; its ceiling is in the final report.
+ */
+enum dispatch_mode {
+	DISPATCH_RR,
+	DISPATCH_CRC,
+	DISPATCH_TOEPLITZ,
+};
+
+static const char *const dispatch_names[] = {
+	[DISPATCH_RR] = "rr",
+	[DISPATCH_CRC] = "crc",
+	[DISPATCH_TOEPLITZ] = "toeplitz",
+};
+
+static enum dispatch_mode dispatch_mode = DISPATCH_RR;
+
+#define RSS_KEY_LEN 40
+
+/* The usual default RSS key, byte-swapped for rte_softrss_be() at startup. */
+static uint8_t dispatch_rss_key[RSS_KEY_LEN] __rte_aligned(4) = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
 
 static const struct rte_eth_conf port_conf_default = {
-	.rxmode = { .max_rx_pkt_len = ETHER_MAX_LEN }
+	.rxmode = {
+		.mq_mode = ETH_MQ_RX_RSS,
+		.max_rx_pkt_len = ETHER_MAX_LEN,
+	},
+	.rx_adv_conf = {
+		.rss_conf = {
+			.rss_key = NULL,
+			.rss_hf = ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP,
+		},
+	},
 };
 
-static int
-lcore_recv(__attribute__((unused)) void *arg)
+/*
+ * How the slave lcores are put to work. In the pipeline every packet
+ * goes RX lcore -> worker -> TX lcore, each hop over a single-producer,
+ * single-consumer ring; in run-to-completion one lcore does all three on
+ * its own RX and TX queue. With no TX lcores (or --tx 0 in
+ * run-to-completion) packets are dropped after the work instead of being
+ * sent back out.
+ */
+enum topo_mode {
+	MODE_PIPELINE,
+	MODE_RTC,
+};
+
+static struct {
+	enum topo_mode mode;
+	unsigned nb_rx;		/* 0: --queues, or 1 */
+	unsigned nb_workers;
+	unsigned nb_tx;
+} topo = {
+	.mode = MODE_PIPELINE,
+	.nb_rx = 0,
+	.nb_workers = 0,
+	.nb_tx = 0,
+};
+
+enum lcore_role {
+	ROLE_NONE,
+	ROLE_RX,
+	ROLE_WORKER,
+	ROLE_TX,
+	ROLE_RTC,
+};
+
+static const char * const role_names[] = {
+	[ROLE_NONE] = "idle",
+	[ROLE_RX] = "rx",
+	[ROLE_WORKER] = "worker",
+	[ROLE_TX] = "tx",
+	[ROLE_RTC] = "rtc",
+};
+
+/*
+ * Per-lcore context, whatever the role. RX and TX lcores own one queue,
+ * run-to-completion lcores one of each with the same number. A stage
+ * reads its input rings and writes its output rings round-robin, one
+ * burst at a time. The counters are only written by the owning lcore.
+ */
+struct lcore_ctx {
+	enum lcore_role role;
+	uint8_t port;
+	uint16_t queue;
+	uint16_t nb_in;
+	uint16_t nb_out;
+	uint16_t next_in;
+	uint16_t next_out;
+	struct rte_ring *in[RTE_MAX_LCORE];
+	struct rte_ring *out[RTE_MAX_LCORE];
+
+	uint64_t pkts;		/* received, processed or sent, by role */
+	uint64_t bytes;
+	uint64_t drops;		/* full ring or TX queue */
+	uint64_t start_tsc;	/* first packet seen */
+	uint64_t busy_cycles;	/* RX: polls that brought packets, to the rings */
+	struct txrx_lat_hist *lat;	/* workers: latency of the probes */
+	struct txrx_cksum_stats cksum;	/* workers, with --rx-cksum */
+	struct txrx_verify_stats verify;	/* workers, with --verify */
+	struct txrx_poll_lcore poll;	/* with TXRX_POLL_STATS only */
+	unsigned epoch;			/* warm-up epoch of the counters */
+} __rte_cache_aligned;
+
+/* Everything the reporter sums over the lcores. */
+struct rx_sample {
+	struct txrx_sample io;
+	uint64_t worker_pkts;
+	uint64_t tx_pkts;
+	struct txrx_lat_hist lat;
+};
+
+static struct lcore_ctx lcore_ctx[RTE_MAX_LCORE];
+
+static void
+print_eth_stats(uint8_t portid, uint64_t cycles, uint64_t rx_count,
+		uint64_t rx_bytes)
+{
+	struct rte_eth_stats stats;
+
+	if (rte_eth_stats_get(portid, &stats)) {
+		rte_exit(EXIT_FAILURE, "Couldn't get stats for port %d\n", portid);
+	}
+
+	printf("time diff: %"PRIu64 "ns \n", txrx_cycles_to_ns(cycles));
+	printf("stats ipackets %"PRIu64 "\n", stats.ipackets);
+	printf("stats opackets %"PRIu64 "\n", stats.opackets);
+	printf("stats ibytes %"PRIu64 "\n", stats.ibytes);
+	printf("stats imissed %"PRIu64 "\n", stats.imissed);
+	printf("count ipackets %"PRIu64 "\n", rx_count);
+	printf("count ibytes %"PRIu64 "\n", rx_bytes);
+	txrx_print_rate("throughput on stats", stats.ipackets, stats.ibytes,
+			cycles);
+	txrx_print_rate("throughput on counts", rx_count, rx_bytes, cycles);
+}
+
+/*
+ * The per-packet work, the same in both topologies: check the checksums
+ * and the payloads if asked to, record the probe's latency and, if the
+ * packet goes back out, swap its MAC addresses.
+ */
+static inline void
+process_burst(struct lcore_ctx *ctx, struct rte_mbuf **bufs, unsigned n,
+		int reflect)
+{
+	const uint64_t now = rte_rdtsc();
+
+	if (txrx_cksum_conf.check)
+		txrx_cksum_burst(&ctx->cksum, bufs, n);
+
+	for (unsigned i = 0; i < n; i++) {
+		const struct txrx_probe *probe = txrx_probe_get(bufs[i]);
+
+		if (probe != NULL) {
+			txrx_lat_record(ctx->lat, now, probe->tsc);
+			if (txrx_verify_conf.kernel != VERIFY_OFF)
+				txrx_verify_probe(&ctx->verify, bufs[i],
+						probe);
+		}
+		if (reflect) {
+			struct ether_hdr *eth = rte_pktmbuf_mtod(bufs[i],
+					struct ether_hdr *);
+			struct ether_addr tmp;
+
+			ether_addr_copy(&eth->s_addr, &tmp);
+			ether_addr_copy(&eth->d_addr, &eth->s_addr);
+			ether_addr_copy(&tmp, &eth->d_addr);
+		}
+	}
+}
+
+/* Frees what a ring or TX queue did not take and counts it as dropped. */
+static inline void
+drop_unsent(struct lcore_ctx *ctx, struct rte_mbuf **bufs, unsigned sent,
+		unsigned n)
+{
+	if (likely(sent == n))
+		return;
+	ctx->drops += n - sent;
+	for (unsigned i = sent; i < n; i++)
+		rte_pktmbuf_free(bufs[i]);
+}
+
+/* The end of the line for a burst nobody sends on. */
+static inline void
+free_burst(struct rte_mbuf **bufs, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		rte_pktmbuf_free(bufs[i]);
+}
+
+/* Passes a burst to the next output ring. */
+static inline void
+stage_send(struct lcore_ctx *ctx, struct rte_mbuf **bufs, unsigned n)
 {
-	unsigned lcore_id = rte_lcore_id();
-	
-	recv_ring = rte_ring_lookup(_PRI_2_SEC);
-       	send_ring = rte_ring_lookup(_SEC_2_PRI);
-       	message_pool = rte_mempool_lookup(_MSG_POOL);
-
-	printf("Starting core %u\n", lcore_id);
-	printf("quit flag %d", quit);
-	//#TODO: while loop is not entered?
-	while (!quit){
-		void *msg;
-		if (rte_ring_dequeue(recv_ring, &msg) < 0){
-			//usleep(5);
+	struct rte_ring *ring = ctx->out[ctx->next_out];
+	unsigned sent;
+
+	if (++ctx->next_out == ctx->nb_out)
+		ctx->next_out = 0;
+	sent = rte_ring_sp_enqueue_burst(ring, (void **) bufs, n, NULL);
+	drop_unsent(ctx, bufs, sent, n);
+}
+
+/*
+ * Hash of a packet's flow for the dispatch modes. Packets other than
+ * IPv4 hash to 0, they all go to the same worker.
+ */
+static inline uint32_t
+dispatch_hash(const struct rte_mbuf *m)
+{
+	const struct ether_hdr *eth = rte_pktmbuf_mtod(m,
+			const struct ether_hdr *);
+	const struct ipv4_hdr *ip = (const struct ipv4_hdr *) (eth + 1);
+	/* TCP has its ports at the same place */
+	const struct udp_hdr *udp = (const struct udp_hdr *) (ip + 1);
+	struct rte_ipv4_tuple tuple;
+	int ports;
+
+	if (m->ol_flags & PKT_RX_RSS_HASH)
+		return m->hash.rss;
+	if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+			rte_pktmbuf_data_len(m) <
+			sizeof(*eth) + sizeof(*ip) + sizeof(*udp))
+		return 0;
+
+	ports = (ip->next_proto_id == IPPROTO_UDP ||
+			ip->next_proto_id == IPPROTO_TCP) &&
+			ip->version_ihl == 0x45 &&
+			(ip->fragment_offset &
+			 rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK)) == 0;
+	tuple.src_addr = rte_be_to_cpu_32(ip->src_addr);
+	tuple.dst_addr = rte_be_to_cpu_32(ip->dst_addr);
+	tuple.sctp_tag = 0;
+	if (ports) {
+		tuple.sport = rte_be_to_cpu_16(udp->src_port);
+		tuple.dport = rte_be_to_cpu_16(udp->dst_port);
+	}
+	if (dispatch_mode == DISPATCH_TOEPLITZ)
+		return rte_softrss_be((uint32_t *) &tuple, ports ?
+				RTE_THASH_V4_L4_LEN : RTE_THASH_V4_L3_LEN,
+				dispatch_rss_key);
+	return rte_hash_crc(&tuple, sizeof(tuple), 0);
+}
+
+/*
+ * Passes a burst to the output rings by flow hash. The burst is sorted
+ * by ring first, keeping the order within each, so every ring gets its
+ * packets in one enqueue.
+ */
+static inline void
+stage_dispatch(struct lcore_ctx *ctx, struct rte_mbuf **bufs, unsigned n)
+{
+	struct rte_mbuf *sorted[MAX_BURST_SIZE];
+	uint16_t ring_of[MAX_BURST_SIZE];
+	uint16_t end[RTE_MAX_LCORE + 1];
+	const unsigned nb_out = ctx->nb_out;
+	unsigned i, r, begin, sent;
+
+	memset(end, 0, (nb_out + 1) * sizeof(end[0]));
+	for (i = 0; i < n; i++) {
+		/* the high bits pick the ring, RSS used the low ones */
+		ring_of[i] = ((uint64_t) dispatch_hash(bufs[i]) * nb_out) >> 32;
+		end[ring_of[i] + 1]++;
+	}
+	for (r = 0; r < nb_out; r++)
+		end[r + 1] += end[r];
+	/* end[r] moves from the start to the end of ring r's packets */
+	for (i = 0; i < n; i++)
+		sorted[end[ring_of[i]]++] = bufs[i];
+
+	for (r = 0, begin = 0; r < nb_out; begin = end[r], r++) {
+		if (end[r] == begin)
+			continue;
+		sent = rte_ring_sp_enqueue_burst(ctx->out[r],
+				(void **) &sorted[begin], end[r] - begin, NULL);
+		drop_unsent(ctx, &sorted[begin], sent, end[r] - begin);
+	}
+}
+
+/* Takes a burst from the next input ring. */
+static inline unsigned
+stage_recv(struct lcore_ctx *ctx, struct rte_mbuf **bufs)
+{
+	struct rte_ring *ring = ctx->in[ctx->next_in];
+
+	if (++ctx->next_in == ctx->nb_in)
+		ctx->next_in = 0;
+	return rte_ring_sc_dequeue_burst(ring, (void **) bufs,
+			txrx_conf.burst, NULL);
+}
+
+/* Drops what the lcore counted during the warm-up. */
+static void
+lcore_restart(struct lcore_ctx *ctx)
+{
+	ctx->pkts = 0;
+	ctx->bytes = 0;
+	ctx->drops = 0;
+	ctx->start_tsc = 0;
+	ctx->busy_cycles = 0;
+	if (ctx->lat != NULL)
+		memset(ctx->lat, 0, sizeof(*ctx->lat));
+	memset(&ctx->cksum, 0, sizeof(ctx->cksum));
+	memset(&ctx->verify, 0, sizeof(ctx->verify));
+	txrx_poll_reset(&ctx->poll);
+	txrx_epoch_ack(&ctx->epoch);
+}
+
+/*
+ * The RX stage. The cycles of the polls that brought packets, up to their
+ * last enqueue, are what the lcore needs per packet: its ceiling as a
+ * dispatcher.
+ */
+static void
+lcore_rx(struct lcore_ctx *ctx)
+{
+	while (!txrx_quit) {
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+		uint64_t poll_tsc, busy_tsc;
+		uint16_t nb_rx;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_restart(ctx);
+		busy_tsc = rte_rdtsc();
+		poll_tsc = txrx_poll_start();
+		nb_rx = rte_eth_rx_burst(ctx->port, ctx->queue, bufs,
+				txrx_conf.burst);
+		txrx_poll_end(&ctx->poll.rx, poll_tsc, nb_rx, txrx_conf.burst);
+		if (nb_rx == 0)
+			continue;
+		if (unlikely(ctx->start_tsc == 0))
+			ctx->start_tsc = rte_rdtsc();
+		ctx->pkts += nb_rx;
+		for (uint16_t i = 0; i < nb_rx; i++)
+			ctx->bytes += rte_pktmbuf_pkt_len(bufs[i]);
+		if (dispatch_mode == DISPATCH_RR)
+			stage_send(ctx, bufs, nb_rx);
+		else
+			stage_dispatch(ctx, bufs, nb_rx);
+		ctx->busy_cycles += rte_rdtsc() - busy_tsc;
+	}
+}
+
+static void
+lcore_worker(struct lcore_ctx *ctx)
+{
+	while (!txrx_quit) {
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+		unsigned nb;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_restart(ctx);
+		nb = stage_recv(ctx, bufs);
+		if (nb == 0)
+			continue;
+		process_burst(ctx, bufs, nb, ctx->nb_out != 0);
+		ctx->pkts += nb;
+		if (ctx->nb_out != 0)
+			stage_send(ctx, bufs, nb);
+		else
+			free_burst(bufs, nb);
+	}
+}
+
+static void
+lcore_tx(struct lcore_ctx *ctx)
+{
+	while (!txrx_quit) {
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+		uint64_t poll_tsc;
+		uint16_t sent;
+		unsigned nb;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_restart(ctx);
+		nb = stage_recv(ctx, bufs);
+		if (nb == 0)
+			continue;
+		poll_tsc = txrx_poll_start();
+		sent = rte_eth_tx_burst(ctx->port, ctx->queue, bufs, nb);
+		txrx_poll_end(&ctx->poll.tx, poll_tsc, sent, txrx_conf.burst);
+		ctx->pkts += sent;
+		drop_unsent(ctx, bufs, sent, nb);
+	}
+}
+
+/* Run-to-completion: receive, work and send or drop on one lcore. */
+static void
+lcore_rtc(struct lcore_ctx *ctx)
+{
+	const int reflect = topo.nb_tx != 0;
+
+	while (!txrx_quit) {
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+		uint64_t poll_tsc;
+		uint16_t nb_rx, sent;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_restart(ctx);
+		poll_tsc = txrx_poll_start();
+		nb_rx = rte_eth_rx_burst(ctx->port, ctx->queue, bufs,
+				txrx_conf.burst);
+		txrx_poll_end(&ctx->poll.rx, poll_tsc, nb_rx, txrx_conf.burst);
+		if (nb_rx == 0)
+			continue;
+		if (unlikely(ctx->start_tsc == 0))
+			ctx->start_tsc = rte_rdtsc();
+		ctx->pkts += nb_rx;
+		for (uint16_t i = 0; i < nb_rx; i++)
+			ctx->bytes += rte_pktmbuf_pkt_len(bufs[i]);
+		process_burst(ctx, bufs, nb_rx, reflect);
+		if (!reflect) {
+			free_burst(bufs, nb_rx);
 			continue;
 		}
-		printf("core %u: Received '%s'\n", lcore_id, (char *)msg);
-		rte_mempool_put(message_pool, msg);
+		poll_tsc = txrx_poll_start();
+		sent = rte_eth_tx_burst(ctx->port, ctx->queue, bufs, nb_rx);
+		txrx_poll_end(&ctx->poll.tx, poll_tsc, sent, txrx_conf.burst);
+		drop_unsent(ctx, bufs, sent, nb_rx);
 	}
-	printf("after while");
+}
+
+static int
+lcore_main_loop(void *arg)
+{
+	struct lcore_ctx *ctx = arg;
 
+	/* Workers never touch the port, only the rings. */
+	if (ctx->role != ROLE_WORKER)
+		txrx_check_lcore_socket(rte_lcore_id(), ctx->port);
+
+	printf("Core %u: %s, %u input ring(s), %u output ring(s)\n",
+			rte_lcore_id(), role_names[ctx->role], ctx->nb_in,
+			ctx->nb_out);
+
+	txrx_wait_go();
+	txrx_poll_loop_begin(&ctx->poll);
+	switch (ctx->role) {
+	case ROLE_RX:
+		lcore_rx(ctx);
+		break;
+	case ROLE_WORKER:
+		lcore_worker(ctx);
+		break;
+	case ROLE_TX:
+		lcore_tx(ctx);
+		break;
+	case ROLE_RTC:
+		lcore_rtc(ctx);
+		break;
+	case ROLE_NONE:
+		break;
+	}
+	txrx_poll_loop_end(&ctx->poll);
 	return 0;
 }
 
-/* basicfwd.c: Basic DPDK skeleton forwarding example. */
-
 /*
  * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * coming from the mbuf_pool passed as a parameter. With more than one RX
+ * queue the port spreads incoming flows over them with RSS.
  */
 static inline int
-port_init(uint8_t port, struct rte_mempool *mbuf_pool)
+port_init(uint8_t port, struct rte_mempool *mbuf_pool, uint16_t rx_rings,
+		uint16_t tx_rings)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	struct rte_eth_dev_info dev_info;
 	int retval;
 	uint16_t q;
 
 	if (port >= rte_eth_dev_count())
 		return -1;
 
+	rte_eth_dev_info_get(port, &dev_info);
+	if (rx_rings > dev_info.max_rx_queues ||
+			tx_rings > dev_info.max_tx_queues) {
+		printf("Port %u supports %u RX and %u TX queues, %u and %u "
+				"requested\n", (unsigned)port,
+				dev_info.max_rx_queues, dev_info.max_tx_queues,
+				(unsigned)rx_rings, (unsigned)tx_rings);
+		return -1;
+	}
+
+	/* Only hash on what the device can hash on, RSS is pointless for 1 queue. */
+	port_conf.rx_adv_conf.rss_conf.rss_hf &= dev_info.flow_type_rss_offloads;
+	if (rx_rings == 1 || port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+		port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+	txrx_cksum_port_conf(port, &dev_info, &port_conf);
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
 		return retval;
 
-	/* Allocate and set up 1 RX queue per Ethernet port. */
+	/* Allocate and set up 1 RX queue per RX lcore. */
 	for (q = 0; q < rx_rings; q++) {
-		retval = rte_eth_rx_queue_setup(port, q, RX_RING_SIZE,
+		retval = rte_eth_rx_queue_setup(port, q, txrx_conf.rx_ring_size,
 				rte_eth_dev_socket_id(port), NULL, mbuf_pool);
 		if (retval < 0)
 			return retval;
 	}
 
-	/* Allocate and set up 1 TX queue per Ethernet port. */
+	/* Allocate and set up 1 TX queue per TX lcore. */
 	for (q = 0; q < tx_rings; q++) {
-		retval = rte_eth_tx_queue_setup(port, q, TX_RING_SIZE,
+		retval = rte_eth_tx_queue_setup(port, q, txrx_conf.tx_ring_size,
 				rte_eth_dev_socket_id(port), NULL);
 		if (retval < 0)
 			return retval;
@@ -156,89 +624,477 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 	return 0;
 }
 
+/* Sums the lcore counters by role and reads the port counters. */
+static void
+sample_rx_stats(uint8_t port, struct rx_sample *sample)
+{
+	unsigned lcore_id;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->io.tsc = rte_rdtsc();
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_ctx *ctx = &lcore_ctx[lcore_id];
+
+		switch (ctx->role) {
+		case ROLE_RX:
+			sample->io.pkts += ctx->pkts;
+			sample->io.bytes += ctx->bytes;
+			break;
+		case ROLE_RTC:
+			sample->io.pkts += ctx->pkts;
+			sample->io.bytes += ctx->bytes;
+			sample->worker_pkts += ctx->pkts;
+			if (topo.nb_tx != 0)
+				sample->tx_pkts += ctx->pkts - ctx->drops;
+			break;
+		case ROLE_WORKER:
+			sample->worker_pkts += ctx->pkts;
+			break;
+		case ROLE_TX:
+			sample->tx_pkts += ctx->pkts;
+			break;
+		case ROLE_NONE:
+			continue;
+		}
+		sample->io.drops += ctx->drops;
+		if (ctx->lat != NULL)
+			txrx_lat_merge(&sample->lat, ctx->lat);
+	}
+	rte_eth_stats_get(port, &sample->io.eth);
+}
+
+/* Packets received so far, for --count. */
+static uint64_t
+count_rx_pkts(void)
+{
+	uint64_t pkts = 0;
+	unsigned lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_ctx *ctx = &lcore_ctx[lcore_id];
+
+		if (ctx->role == ROLE_RX || ctx->role == ROLE_RTC)
+			pkts += ctx->pkts;
+	}
+	return pkts;
+}
+
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * The stats reporter. App drops are packets a full ring or TX queue did
+ * not take; packets freed after the work when nothing is sent are not
+ * drops.
  */
-static __attribute__((noreturn)) void
-lcore_main(void)
+static void
+report_loop(uint8_t port)
 {
-	const uint8_t nb_ports = rte_eth_dev_count();
-	uint8_t port;
+	const uint64_t interval = txrx_ns_to_cycles(STATS_INTERVAL_MS * 1000000ULL);
+	struct rx_sample *prev, *cur, *tmp;
+	struct txrx_lat_hist *lat_delta;
+	struct txrx_xstats xstats;
+	struct txrx_run run;
+	uint64_t start_tsc;
+	unsigned lcore_id, nb_lcores = 0;
+	int stop;
 
-	/*
-	 * Check that the port is on the same NUMA node as the polling thread
-	 * for best performance.
-	 */
-	for (port = 0; port < nb_ports; port++)
-		if (rte_eth_dev_socket_id(port) > 0 &&
-				rte_eth_dev_socket_id(port) !=
-						(int)rte_socket_id())
-			printf("WARNING, port %u is on remote NUMA node to "
-					"polling thread.\n\tPerformance will "
-					"not be optimal.\n", port);
-
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-			rte_lcore_id());
-	
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-	/* on the current machine, mellanox NIC is on port 0, so we enforce port=0 here*/
-	port=0;
-	uint16_t count=0;
-	struct rte_mempool *m_pool;
-	/* Run until the application is quit or killed. */
-	for (;;) {
-
-		/* Get burst of RX packets */
-		struct rte_mbuf *bufs[BURST_SIZE];
-		void *msg; //=NULL?, then ret_mempool_get fails
-		const uint16_t nb_rx = rte_eth_rx_burst(port, 0, bufs, BURST_SIZE);
-		count=count+nb_rx;
-		m_pool = rte_mempool_lookup(_MSG_POOL);
-		if(m_pool == NULL) {
-      			printf("Where is my Message pool, pool creation failed\n");
-   		}
-					
-		//rte_mempool:
-		//Note that it can return -ENOENT when the local cache and common pool are empty, even if cache from other lcores are full.					
-		//if (rte_mempool_get(message_pool, &msg) < 0)
-                //	rte_panic("Failed to get message buffer\n");
-
-		if(nb_rx>0){
-			//TODO: fix the char printing issues 
-			char lo = (char) count & 0xFF;
- 			char hi = count >> 8;
-			//printf("low:%s",lo);
-			// we need a char msg[2];
-			char* msgchars;
-			msgchars = (char *) malloc(sizeof(char)*2);
-			msgchars[0] = lo;
-			msgchars[1] = hi;
-			
-			if (rte_mempool_get(message_pool, &msg) < 0)
-                        	rte_panic("Failed to get message buffer\n");	
-
-			snprintf((char *)msg, string_size, "%s", msgchars );
-			//printf("%s\n", msgchars);
-			printf("packet #%" PRIu16 ":%s",count, (char *) msg);
-			//printf("rte: %d\n", rte_ring_enqueue(send_ring, msg));
-        		if (rte_ring_enqueue(send_ring, msg) < 0) {
-                		printf("Failed to send message - message discarded\n");
-                		rte_mempool_put(message_pool, msg);
+	prev = calloc(1, sizeof(*prev));
+	cur = calloc(1, sizeof(*cur));
+	lat_delta = calloc(1, sizeof(*lat_delta));
+	if (prev == NULL || cur == NULL || lat_delta == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate stats samples\n");
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (lcore_ctx[lcore_id].role != ROLE_NONE)
+			nb_lcores++;
+	}
+	txrx_xstats_init(&xstats, port);
+	txrx_run_start(&run, nb_lcores, count_rx_pkts);
+	sample_rx_stats(port, prev);
+	start_tsc = prev->io.tsc;
+	do {
+		stop = txrx_run_wait(&run, prev->io.tsc + interval);
+		if (txrx_run_warm(&run)) {
+			txrx_port_stats_reset(port, &xstats);
+			sample_rx_stats(port, prev);
+			continue;
+		}
+		sample_rx_stats(port, cur);
+		txrx_print_interval("RX", start_tsc, &prev->io, &cur->io);
+		printf("    worked +%" PRIu64 " sent +%" PRIu64 "\n",
+				cur->worker_pkts - prev->worker_pkts,
+				cur->tx_pkts - prev->tx_pkts);
+		txrx_lat_delta(lat_delta, &cur->lat, &prev->lat);
+		txrx_lat_print("    latency", lat_delta);
+		txrx_xstats_print(&xstats, port);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	} while (!stop);
+	txrx_xstats_free(&xstats);
+	free(prev);
+	free(cur);
+	free(lat_delta);
+}
+
+/*
+ * Prints the per-lcore counters and the totals since the first packet
+ * after the warm-up, once the datapath has stopped.
+ */
+static void
+report_totals(uint8_t port)
+{
+	struct rx_sample *total = calloc(1, sizeof(*total));
+	struct txrx_cksum_stats cksum = { 0 };
+	struct txrx_verify_stats verify = { 0 };
+	uint64_t first_tsc = 0;
+	unsigned lcore_id, nb_lcores = 0;
+
+	if (total == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate stats sample\n");
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_ctx *ctx = &lcore_ctx[lcore_id];
+
+		if (ctx->role == ROLE_NONE)
+			continue;
+		printf("lcore %u (%s): packets %" PRIu64 " drops %" PRIu64 "\n",
+				lcore_id, role_names[ctx->role], ctx->pkts,
+				ctx->drops);
+		if (ctx->role == ROLE_RX && ctx->busy_cycles != 0)
+			printf("    %s dispatch: %.1f cycles/pkt, ceiling %.2f "
+					"Mpps\n", dispatch_names[dispatch_mode],
+					(double) ctx->busy_cycles / ctx->pkts,
+					(double) txrx_tsc_hz * ctx->pkts /
+					ctx->busy_cycles / 1e6);
+		txrx_poll_print(lcore_id, &ctx->poll, txrx_conf.burst);
+		txrx_cksum_merge(&cksum, &ctx->cksum);
+		txrx_verify_merge(&verify, &ctx->verify);
+		nb_lcores++;
+		if (ctx->start_tsc != 0 &&
+				(first_tsc == 0 || ctx->start_tsc < first_tsc))
+			first_tsc = ctx->start_tsc;
+	}
+	sample_rx_stats(port, total);
+	if (first_tsc != 0) {
+		print_eth_stats(port, total->io.tsc - first_tsc, total->io.pkts,
+				total->io.bytes);
+		txrx_lat_print("latency", &total->lat);
+		txrx_cksum_print("checksums", &cksum);
+		txrx_verify_print("payloads", &verify);
+		txrx_print_result(topo.mode == MODE_RTC ? "rtc" : "pipeline",
+				nb_lcores, total->io.pkts, total->io.bytes,
+				total->io.drops + total->io.eth.imissed +
+				total->io.eth.rx_nombuf,
+				total->io.tsc - first_tsc);
+	}
+	free(total);
+}
+
+static void *
+report_thread(void *arg)
+{
+	report_loop(*(uint8_t *) arg);
+	return NULL;
+}
+
+static void
+print_usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [--mode pipeline|rtc] [--rx N]\n"
+		"    [--workers M] [--tx K] [--pipe-ring N]\n"
+		"    [--dispatch rr|crc|toeplitz] [common options]\n"
+		"    [checksum options] [verify options]\n"
+		"  --mode pipeline: N RX, M worker and K TX lcores connected by\n"
+		"      SP/SC rings (default)\n"
+		"  --mode rtc: every slave lcore receives, works and sends on its\n"
+		"      own queue pair\n"
+		"  --rx N: RX lcores/queues (default --queues or 1; rtc: --queues\n"
+		"      or all slaves)\n"
+		"  --workers M: worker lcores (default: the remaining slaves)\n"
+		"  --tx K: TX lcores/queues sending packets back out MAC-swapped,\n"
+		"      0 drops them after the work (default 0; rtc: 0 or 1)\n"
+		"  --pipe-ring N: entries per pipeline ring, a power of 2\n"
+		"      (default %u)\n"
+		"  --dispatch rr|crc|toeplitz: RX lcores spread bursts over the\n"
+		"      workers round-robin, or packets by flow with the NIC's\n"
+		"      RSS hash, or a CRC32 or Toeplitz hash of their own when\n"
+		"      there is none (default rr)\n",
+		prgname, pipe_ring_size);
+	txrx_conf_usage();
+	txrx_cksum_usage();
+	txrx_verify_usage();
+}
+
+#define CMD_LINE_OPT_MODE "mode"
+#define CMD_LINE_OPT_RX "rx"
+#define CMD_LINE_OPT_WORKERS "workers"
+#define CMD_LINE_OPT_TX "tx"
+#define CMD_LINE_OPT_PIPE_RING "pipe-ring"
+#define CMD_LINE_OPT_DISPATCH "dispatch"
+
+enum {
+	/* long options mapped to a short option */
+
+	/* first long only option value must be >= 256, so that we won't
+	 * conflict with short options */
+	CMD_LINE_OPT_MIN_NUM = 256,
+	CMD_LINE_OPT_MODE_NUM,
+	CMD_LINE_OPT_RX_NUM,
+	CMD_LINE_OPT_WORKERS_NUM,
+	CMD_LINE_OPT_TX_NUM,
+	CMD_LINE_OPT_PIPE_RING_NUM,
+	CMD_LINE_OPT_DISPATCH_NUM,
+};
+
+static const char short_options[] = "";
+
+static const struct option lgopts[] = {
+	{ CMD_LINE_OPT_MODE, required_argument, NULL, CMD_LINE_OPT_MODE_NUM },
+	{ CMD_LINE_OPT_RX, required_argument, NULL, CMD_LINE_OPT_RX_NUM },
+	{ CMD_LINE_OPT_WORKERS, required_argument, NULL, CMD_LINE_OPT_WORKERS_NUM },
+	{ CMD_LINE_OPT_TX, required_argument, NULL, CMD_LINE_OPT_TX_NUM },
+	{ CMD_LINE_OPT_PIPE_RING, required_argument, NULL, CMD_LINE_OPT_PIPE_RING_NUM },
+	{ CMD_LINE_OPT_DISPATCH, required_argument, NULL, CMD_LINE_OPT_DISPATCH_NUM },
+	TXRX_CONF_LGOPTS,
+	TXRX_CKSUM_LGOPTS,
+	TXRX_VERIFY_LGOPTS,
+	{ NULL, 0, 0, 0 }
+};
+
+static int
+parse_count(const char *arg, unsigned *count)
+{
+	unsigned long n;
+	char *end;
+
+	n = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || n >= RTE_MAX_LCORE)
+		return -1;
+	*count = n;
+	return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+	char *prgname = argv[0];
+	unsigned long n;
+	char *end;
+	int opt, ret;
+
+	while ((opt = getopt_long(argc, argv, short_options,
+			lgopts, NULL)) != EOF) {
+		switch (opt) {
+		case CMD_LINE_OPT_MODE_NUM:
+			if (strcmp(optarg, "pipeline") == 0)
+				topo.mode = MODE_PIPELINE;
+			else if (strcmp(optarg, "rtc") == 0)
+				topo.mode = MODE_RTC;
+			else {
+				printf("invalid mode %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_RX_NUM:
+		case CMD_LINE_OPT_WORKERS_NUM:
+		case CMD_LINE_OPT_TX_NUM:
+			if (parse_count(optarg, opt == CMD_LINE_OPT_RX_NUM ?
+					&topo.nb_rx : opt == CMD_LINE_OPT_TX_NUM ?
+					&topo.nb_tx : &topo.nb_workers) < 0) {
+				printf("invalid lcore count %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_PIPE_RING_NUM:
+			n = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || n < 2 ||
+					n > RTE_RING_SZ_MASK ||
+					!rte_is_power_of_2(n)) {
+				printf("invalid ring size %s\n", optarg);
+				print_usage(prgname);
+				return -1;
 			}
-        	}
-		
-		/*if (fp != NULL){
- 			//fprintf(fp, "Port number %d \n", port);
-			for(int i=0;i < nb_rx;i++)
- 				rte_pktmbuf_dump(fp, bufs[i], sizeof(bufs[i]));
+			pipe_ring_size = n;
+			break;
+		case CMD_LINE_OPT_DISPATCH_NUM:
+			for (n = 0; n < RTE_DIM(dispatch_names); n++) {
+				if (strcmp(optarg, dispatch_names[n]) == 0)
+					break;
+			}
+			if (n == RTE_DIM(dispatch_names)) {
+				printf("invalid dispatch mode %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			dispatch_mode = n;
+			break;
+		default:
+			ret = txrx_conf_parse(opt, optarg);
+			if (ret > 0)
+				ret = txrx_cksum_parse(opt, optarg);
+			if (ret > 0)
+				ret = txrx_verify_parse(opt, optarg);
+			if (ret != 0) {
+				print_usage(prgname);
+				return -1;
+			}
+			break;
 		}
-		//if (unlikely(nb_rx == 0))
-		//	continue;*/
-		for(int i=0;i< nb_rx;i++)
-			rte_pktmbuf_free(bufs[i]);
 	}
+
+	if (dispatch_mode != DISPATCH_RR && topo.mode != MODE_PIPELINE) {
+		printf("--dispatch needs --mode pipeline\n");
+		return -1;
+	}
+	if (dispatch_mode == DISPATCH_TOEPLITZ)
+		rte_convert_rss_key((const uint32_t *) dispatch_rss_key,
+				(uint32_t *) dispatch_rss_key, RSS_KEY_LEN);
+
+	if (optind >= 0)
+		argv[optind-1] = prgname;
+
+	optind = 1; /* reset getopt lib */
+	return 0;
+}
+
+/*
+ * Creates the SP/SC ring from one lcore to another, on the consumer's
+ * socket.
+ */
+static void
+connect_lcores(unsigned from, unsigned to)
+{
+	struct lcore_ctx *src = &lcore_ctx[from], *dst = &lcore_ctx[to];
+	char name[RTE_RING_NAMESIZE];
+	struct rte_ring *ring;
+
+	snprintf(name, sizeof(name), "PIPE_%u_%u", from, to);
+	ring = rte_ring_create(name, pipe_ring_size, rte_lcore_to_socket_id(to),
+			RING_F_SP_ENQ | RING_F_SC_DEQ);
+	if (ring == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create ring %s\n", name);
+	src->out[src->nb_out++] = ring;
+	dst->in[dst->nb_in++] = ring;
+}
+
+/*
+ * Assigns roles to the slave lcores and wires them up. The lcores that
+ * touch the port come first from its socket: RX lcores, then TX lcores;
+ * workers only touch the rings and get what is left. Every RX lcore feeds
+ * every worker, which spreads the load evenly; each worker feeds one TX
+ * lcore, so each TX lcore drains only a share of the rings. Sets *nb_rxq
+ * and *nb_txq to the queues the port needs.
+ */
+static void
+setup_topology(uint8_t port, uint16_t *nb_rxq, uint16_t *nb_txq)
+{
+	const unsigned nb_slaves = rte_lcore_count() - 1;
+	unsigned rx[RTE_MAX_LCORE], wk[RTE_MAX_LCORE], tx[RTE_MAX_LCORE];
+	unsigned lcores[RTE_MAX_LCORE];
+	unsigned lcore_id, n;
+
+	if (nb_slaves != 0)
+		txrx_pick_lcores(txrx_port_socket(port), lcores);
+	else
+		lcores[0] = rte_get_master_lcore();
+
+	if (topo.mode == MODE_RTC) {
+		if (topo.nb_tx > 1)
+			rte_exit(EXIT_FAILURE, "rtc sends on its own queue, "
+					"--tx must be 0 or 1\n");
+		/* a lone master runs to completion itself */
+		n = nb_slaves != 0 ? nb_slaves : 1;
+		if (topo.nb_rx == 0)
+			topo.nb_rx = txrx_conf_queues(n);
+		else if (topo.nb_rx > n)
+			rte_exit(EXIT_FAILURE, "rtc with %u RX queues needs as "
+					"many lcores, have %u\n", topo.nb_rx, n);
+		topo.nb_workers = 0;
+		*nb_rxq = topo.nb_rx;
+		*nb_txq = topo.nb_rx;
+		for (n = 0; n < topo.nb_rx; n++) {
+			lcore_id = lcores[n];
+			lcore_ctx[lcore_id].role = ROLE_RTC;
+			lcore_ctx[lcore_id].port = port;
+			lcore_ctx[lcore_id].queue = n;
+		}
+		return;
+	}
+
+	if (topo.nb_rx == 0)
+		topo.nb_rx = txrx_conf.nb_queues != 0 ? txrx_conf.nb_queues : 1;
+	if (topo.nb_workers == 0 && nb_slaves > topo.nb_rx + topo.nb_tx)
+		topo.nb_workers = nb_slaves - topo.nb_rx - topo.nb_tx;
+	if (topo.nb_workers == 0 ||
+			topo.nb_rx + topo.nb_workers + topo.nb_tx > nb_slaves)
+		rte_exit(EXIT_FAILURE, "pipeline of %u RX, %u worker and %u TX "
+				"lcores needs that many slave lcores, have %u\n",
+				topo.nb_rx, topo.nb_workers, topo.nb_tx,
+				nb_slaves);
+	/* every TX lcore is fed by the workers w with w % nb_tx == its own */
+	if (topo.nb_tx > topo.nb_workers)
+		rte_exit(EXIT_FAILURE, "%u TX lcores need at least as many "
+				"workers, have %u\n", topo.nb_tx,
+				topo.nb_workers);
+
+	for (n = 0; n < topo.nb_rx + topo.nb_tx + topo.nb_workers; n++) {
+		struct lcore_ctx *ctx = &lcore_ctx[lcores[n]];
+
+		ctx->port = port;
+		if (n < topo.nb_rx) {
+			ctx->role = ROLE_RX;
+			ctx->queue = n;
+			rx[n] = lcores[n];
+		} else if (n < topo.nb_rx + topo.nb_tx) {
+			ctx->role = ROLE_TX;
+			ctx->queue = n - topo.nb_rx;
+			tx[ctx->queue] = lcores[n];
+		} else {
+			ctx->role = ROLE_WORKER;
+			wk[n - topo.nb_rx - topo.nb_tx] = lcores[n];
+		}
+	}
+
+	for (unsigned w = 0; w < topo.nb_workers; w++) {
+		for (unsigned r = 0; r < topo.nb_rx; r++)
+			connect_lcores(rx[r], wk[w]);
+		if (topo.nb_tx != 0)
+			connect_lcores(wk[w], tx[w % topo.nb_tx]);
+	}
+	*nb_rxq = topo.nb_rx;
+	/* the port wants a TX queue even when nothing is sent */
+	*nb_txq = topo.nb_tx != 0 ? topo.nb_tx : 1;
+}
+
+/*
+ * Frees what is left in the pipeline rings once every lcore has stopped.
+ * Those packets were received but never got through, so they count as
+ * drops of the lcore that would have dequeued them.
+ */
+static void
+drain_rings(void)
+{
+	unsigned lcore_id, left = 0;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		struct lcore_ctx *ctx = &lcore_ctx[lcore_id];
+
+		for (unsigned i = 0; i < ctx->nb_in; i++) {
+			struct rte_mbuf *bufs[MAX_BURST_SIZE];
+			unsigned n;
+
+			while ((n = rte_ring_sc_dequeue_burst(ctx->in[i],
+					(void **) bufs, MAX_BURST_SIZE,
+					NULL)) != 0) {
+				free_burst(bufs, n);
+				ctx->drops += n;
+				left += n;
+			}
+		}
+	}
+	if (left != 0)
+		printf("%u packets left in the rings, freed\n", left);
 }
 
 /*
@@ -250,12 +1106,9 @@ main(int argc, char *argv[])
 {
 	struct rte_mempool *mbuf_pool;
 	unsigned nb_ports;
+	unsigned nb_rings = 0;
+	uint16_t nb_rxq, nb_txq;
 	uint8_t portid;
-	const unsigned flags = 0;
-	const unsigned ring_size = 64;
-	const unsigned pool_size = 1024;
-	const unsigned pool_cache = 32;
-	const unsigned priv_data_sz = 0;
 	unsigned lcore_id;
 
 	/* Initialize the Environment Abstraction Layer (EAL). */
@@ -266,66 +1119,79 @@ main(int argc, char *argv[])
 	argc -= ret;
 	argv += ret;
 
-	/* Check that there is an even number of ports to send/receive on. */
+	txrx_time_init();
+	txrx_signals_init();
+
+	ret = parse_args(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Invalid receiver arguments\n");
+
 	nb_ports = rte_eth_dev_count();
 	printf("\nNnumber of Ports: %d\n", nb_ports);
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-		MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-
-	if (mbuf_pool == NULL)
-		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
-
-	/* Initialize all ports. */
-	for (portid = 0; portid < nb_ports; portid++)
-		if (port_init(portid, mbuf_pool) != 0)
-			rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n",
-					portid);
-
-	//if (rte_lcore_count() > 1)
-	//	printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
-
-	/*multi-thread*/
-	send_ring = rte_ring_create(_PRI_2_SEC, ring_size, rte_socket_id(), flags);
-        recv_ring = rte_ring_create(_SEC_2_PRI, ring_size, rte_socket_id(), flags);
-        message_pool = rte_mempool_create(_MSG_POOL, pool_size,
-       				string_size, pool_cache, priv_data_sz,
-                        	NULL, NULL, NULL, NULL,rte_socket_id(), flags);
-	/*	
-        if (rte_eal_process_type() == RTE_PROC_PRIMARY){
-                send_ring = rte_ring_create(_PRI_2_SEC, ring_size, rte_socket_id(), flags);
-                recv_ring = rte_ring_create(_SEC_2_PRI, ring_size, rte_socket_id(), flags);
-                message_pool = rte_mempool_create(_MSG_POOL, pool_size,
-                                string_size, pool_cache, priv_data_sz,
-                                NULL, NULL, NULL, NULL,
-                                rte_socket_id(), flags);
-        } else {
-                recv_ring = rte_ring_lookup(_PRI_2_SEC);
-                send_ring = rte_ring_lookup(_SEC_2_PRI);
-                message_pool = rte_mempool_lookup(_MSG_POOL);
-        }
-        if (send_ring == NULL)
-                rte_exit(EXIT_FAILURE, "Problem getting sending ring\n");
-        if (recv_ring == NULL)
-                rte_exit(EXIT_FAILURE, "Problem getting receiving ring\n");
-        if (message_pool == NULL)
-                rte_exit(EXIT_FAILURE, "Problem getting message pool\n");
-	
-        //RTE_LOG(INFO, APP, "Finished Process Init.\n");
-	*/
-        //call lcore_recv() on every slave lcore
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                rte_eal_remote_launch(lcore_recv, NULL, lcore_id);
-        }
-	
-
-	/* Call lcore_main on the master core only. */
-	lcore_main();
-
-	//rte_eal_mp_wait_lcore();
+	portid = txrx_conf.port;
+	if (portid >= nb_ports)
+		rte_exit(EXIT_FAILURE, "Port %u not available\n", portid);
+
+	setup_topology(portid, &nb_rxq, &nb_txq);
+
+	/* Latency histograms for whoever does the work, on its own socket. */
+	RTE_LCORE_FOREACH(lcore_id) {
+		struct lcore_ctx *ctx = &lcore_ctx[lcore_id];
+
+		nb_rings += ctx->nb_in;
+		if (ctx->role != ROLE_WORKER && ctx->role != ROLE_RTC)
+			continue;
+		ctx->lat = rte_zmalloc_socket("lcore_lat",
+				sizeof(struct txrx_lat_hist), RTE_CACHE_LINE_SIZE,
+				rte_lcore_to_socket_id(lcore_id));
+		if (ctx->lat == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate latency histogram\n");
+	}
+
+	/*
+	 * Creates a new mempool on the NIC's socket to hold the mbufs, with
+	 * room for full pipeline rings and TX queues on top of the RX rings.
+	 */
+	mbuf_pool = txrx_socket_pool("MBUF_POOL", txrx_port_socket(portid),
+		txrx_conf_mbufs(NUM_MBUFS +
+			nb_rxq * (txrx_conf.rx_ring_size + txrx_conf.burst) +
+			nb_rings * pipe_ring_size +
+			nb_txq * txrx_conf.tx_ring_size),
+		txrx_conf.mbuf_cache, RTE_MBUF_DEFAULT_BUF_SIZE);
+
+	/* Initialize the port. */
+	if (port_init(portid, mbuf_pool, nb_rxq, nb_txq) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n", portid);
+
+	if (topo.mode == MODE_RTC)
+		printf("\nRun-to-completion on %u lcore(s), %s\n", topo.nb_rx,
+				topo.nb_tx ? "reflecting" : "dropping");
+	else
+		printf("\nPipeline: %u RX -> %u worker -> %u TX lcore(s), "
+				"%s dispatch\n", topo.nb_rx, topo.nb_workers,
+				topo.nb_tx, dispatch_names[dispatch_mode]);
+
+	if (rte_lcore_count() > 1) {
+		/* The slaves run the datapath, the master reports. */
+		RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+			if (lcore_ctx[lcore_id].role != ROLE_NONE)
+				rte_eal_remote_launch(lcore_main_loop,
+						&lcore_ctx[lcore_id], lcore_id);
+		}
+		report_loop(portid);
+		rte_eal_mp_wait_lcore();
+	} else {
+		pthread_t report_tid;
+
+		if (txrx_stats_thread_start(&report_tid, report_thread,
+				&portid) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot start stats thread\n");
+		lcore_main_loop(&lcore_ctx[rte_get_master_lcore()]);
+		pthread_join(report_tid, NULL);
+	}
+	drain_rings();
+	report_totals(portid);
+	txrx_port_close(portid);
 
 	return 0;
 }
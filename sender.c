@@ -34,36 +34,225 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <arpa/inet.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
 #include <rte_mbuf.h>
-#include <time.h>
+#include <rte_launch.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+#include <rte_hash_crc.h>
+#include <errno.h>
 
-#define RX_RING_SIZE 128
-#define TX_RING_SIZE 512
+#include <rte_atomic.h>
+#include <rte_malloc.h>
 
+#include "txrx_time.h"
+#include "txrx_stats.h"
+#include "txrx_probe.h"
+#include "txrx_conf.h"
+#include "txrx_numa.h"
+#include "txrx_poll.h"
+#include "txrx_pcap.h"
+
+/* Pools get at least this many mbufs unless --mbufs says otherwise. */
 #define NUM_MBUFS 8191
-#define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 32
-#define PAYLOAD_LEN 64
+
+/* Bursts every TX lcore sends unless --bursts says otherwise. */
+#define DEF_BURSTS 65536
+
+/*
+ * Every flow (5-tuple) carries its own sequence numbers, so a TX lcore
+ * keeps one counter per flow of its share. This bounds that share.
+ */
+#define MAX_FLOWS_PER_LCORE (1 << 20)
+
+/* Frame sizes are on-wire Ethernet frames, FCS included. */
+#define MIN_FRAME_LEN ETHER_MIN_LEN
+#define MAX_FRAME_LEN 9000
+#define DEF_FRAME_LEN 64
+
+/*
+ * A TSO super-frame is cut into at most TSO_MAX_SEGS frames and, as its
+ * payload segment is one mbuf, cannot be longer than its data room.
+ */
+#define TSO_MAX_SEGS 64
+#define MAX_TX_LEN (UINT16_MAX - RTE_PKTMBUF_HEADROOM)
+
+#define TCP_FLAGS_ACK_PSH 0x18
+
+/*
+ * Pacing is a token bucket per TX lcore counted in TSC cycles, kept in
+ * fixed point with PACE_SHIFT fractional bits so rates needing less than
+ * one cycle per packet stay exact. The bucket holds PACE_DEPTH bursts,
+ * counted in frames on the wire so a TSO burst always fits.
+ */
+#define PACE_SHIFT 16
+#define PACE_DEPTH 2
 
 static const struct rte_eth_conf port_conf_default = {
-	.rxmode = { .max_rx_pkt_len = ETHER_MAX_LEN }
+	.rxmode = {
+		.max_rx_pkt_len = ETHER_MAX_LEN,
+		.jumbo_frame = 0,	/* turned on in port_init for jumbo sizes */
+	}
 };
 
-static uint64_t
-get_ns_time(void)
-{
-    struct timespec ts;
-    timespec_get(&ts, TIME_UTC);
-    return (uint64_t) ts.tv_nsec;	
-}
+enum cksum_mode {
+	CKSUM_AUTO,	/* in the NIC when it can, in software otherwise */
+	CKSUM_SW,	/* always in software */
+	CKSUM_OFF,	/* UDP without checksum, IPv4 header still summed */
+};
+
+static const char *const cksum_mode_names[] = {
+	[CKSUM_AUTO] = "auto",
+	[CKSUM_SW] = "sw",
+	[CKSUM_OFF] = "off",
+};
+
+/*
+ * What the packet builder writes. The source port range is split
+ * between the TX lcores so that their flow sets never overlap and RSS on
+ * the receiving NIC can spread them; every lcore walks the whole
+ * destination port range.
+ */
+struct pkt_conf {
+	struct ether_addr src_mac;
+	struct ether_addr dst_mac;
+	uint8_t src_mac_set;
+	uint8_t dst_mac_set;
+	uint32_t src_ip;	/* host byte order */
+	uint32_t dst_ip;
+	uint16_t sport_min, sport_max;
+	uint16_t dport_min, dport_max;
+	uint16_t frame_len;
+	uint8_t proto;		/* IPPROTO_UDP or IPPROTO_TCP */
+	uint8_t segs;		/* payload in its own, chained mbuf */
+	uint16_t tso_segs;	/* frames per TSO super-frame, 1 without TSO */
+	enum cksum_mode cksum;
+	uint64_t tx_ol_flags;	/* checksum offloads the PMD does for us */
+	uint8_t sw_l4_cksum;	/* UDP/TCP checksum computed per packet */
+};
+
+enum pace_mode {
+	PACE_NONE,
+	PACE_PPS,	/* packets per second */
+	PACE_GBPS,	/* Gbit/s on the wire, L1 overhead included */
+	PACE_GAP,	/* nanoseconds between bursts of one queue */
+};
+
+/* Requested offered load for the whole port. */
+struct pace_conf {
+	enum pace_mode mode;
+	double value;
+};
+
+static struct pace_conf pace_conf = { .mode = PACE_NONE };
+
+/*
+ * Bursts per TX lcore after the warm-up, 0 for no limit other than
+ * --duration or --count. Unlimited by default when either is given.
+ */
+static uint64_t nb_bursts = DEF_BURSTS;
+static int nb_bursts_set;
+
+/*
+ * --pcap: replay a capture instead of building packets. The template,
+ * the flow options and the offloads do not apply then.
+ */
+static struct {
+	const char *path;
+	double speed;		/* captured timing scaled by 1/speed, 0 unpaced */
+	uint64_t loops;		/* over the capture, 0 for no limit */
+} replay_conf = {
+	.speed = 1,
+	.loops = 1,
+};
+
+/*
+ * The capture --pcap replays, loaded once at startup: every packet sits
+ * in an mbuf of its own pool, ready to send, for the whole run.
+ */
+static struct {
+	struct rte_mbuf **pkts;
+	uint64_t *ts_ns;	/* from the first packet, never going back */
+	uint32_t nb_pkts;
+	uint64_t bytes;
+	uint64_t span_ns;	/* first to last packet */
+} replay;
+
+/* Token bucket state of one TX lcore. */
+struct tx_pacer {
+	uint64_t cost;		/* cycles per packet << PACE_SHIFT, 0 if unpaced */
+	uint64_t depth;
+	uint64_t credit;
+	uint64_t last_tsc;
+};
+
+static struct pkt_conf pkt_conf = {
+	.dst_mac = { .addr_bytes = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } },
+	.src_ip = IPV4(192, 168, 0, 1),
+	.dst_ip = IPV4(192, 168, 0, 2),
+	.sport_min = 1024,
+	.sport_max = 2047,
+	.dport_min = 5001,
+	.dport_max = 5001,
+	.frame_len = DEF_FRAME_LEN,
+	.proto = IPPROTO_UDP,
+	.tso_segs = 1,
+	.cksum = CKSUM_AUTO,
+};
+
+/* A TX lcore's share of the replayed capture. */
+struct tx_replay {
+	struct rte_mbuf **pkts;
+	uint64_t *at;		/* TSC cycles from the start of a loop */
+	uint32_t nb, pos;
+	uint64_t loops;		/* loops done */
+	uint64_t loop_tsc;	/* length of one loop */
+	uint64_t base_tsc;	/* start of the current loop */
+};
+
+/*
+ * Per-lcore TX context. Each TX lcore owns one TX queue and one flow set;
+ * its counters are only written by that lcore and are merged by the master
+ * lcore once all TX loops have returned.
+ */
+struct lcore_tx_ctx {
+	uint8_t port;
+	uint16_t queue;
+	uint16_t sport_lo, sport_hi;	/* this lcore's share of the range */
+	uint16_t sport, dport;		/* next flow to send */
+	uint32_t flow, nb_flows;	/* index of that flow, flows in share */
+	uint32_t *seq;			/* next sequence number of every flow */
+	struct rte_mempool *mbuf_pool;	/* pre-built TX frames */
+	struct rte_mbuf *payload;	/* shared payload segment, --segs */
+	struct tx_pacer pacer;
+	struct tx_replay replay;	/* --pcap only */
+
+	uint64_t bursts;
+	uint64_t tx_pkts;
+	uint64_t tx_bytes;
+	uint64_t tx_dropped;
+	unsigned epoch;			/* txrx_epoch last seen */
+
+	struct txrx_poll_lcore poll;	/* with TXRX_POLL_STATS only */
+} __rte_cache_aligned;
+
+static struct lcore_tx_ctx tx_ctx[RTE_MAX_LCORE];
 
+/* TX lcores still sending; the last one to finish stops the reporter. */
+static rte_atomic32_t tx_running;
 
 static void 
-print_eth_stats(uint8_t portid, uint64_t timediff, uint64_t send_count)
+print_eth_stats(uint8_t portid, uint64_t cycles, uint64_t send_count,
+		uint64_t send_bytes)
 {
 	struct rte_eth_stats stats;
 
@@ -72,81 +261,863 @@ print_eth_stats(uint8_t portid, uint64_t timediff, uint64_t send_count)
 	}
 
 	//printf("TX port %"PRIu8 ":\n", portid);
-	printf("time diff: %"PRIu64 "ns \n", timediff);
+	printf("time diff: %"PRIu64 "ns \n", txrx_cycles_to_ns(cycles));
 	printf("stats ipackets %"PRIu64 "\n", stats.ipackets);
 	printf("stats opackets %"PRIu64 "\n", stats.opackets);
 	printf("stats ibytes %"PRIu64 "\n", stats.ibytes);
 	printf("stats obytes %"PRIu64 "\n", stats.obytes);
 	printf("count opackets %"PRIu64 "\n", send_count);
-	printf("count obytes %"PRIu64 "\n", send_count*64);
-	double timediff_in_second = (double) timediff/ (double) 1000000000;
-	double stats_thru = (double) stats.obytes/ timediff_in_second;
-	double count_thru = send_count*64/timediff_in_second;
-	printf("throughput on stats: %f \n", stats_thru);
-	printf("throughput on counts: %f \n", count_thru);
+	printf("count obytes %"PRIu64 "\n", send_bytes);
+	txrx_print_rate("throughput on stats", stats.opackets, stats.obytes,
+			cycles);
+	txrx_print_rate("throughput on counts", send_count, send_bytes, cycles);
+}
+
+
+/* Offset of the L4 header, the only part of a frame patched per packet. */
+#define L4_HDR_OFFSET (sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr))
+
+/*
+ * The frame every TX mbuf starts out with: Ether/IPv4/UDP or TCP headers
+ * followed by the counting pattern, FCS excluded. Only the ports and the
+ * TCP sequence number differ between packets. With TSO it is a whole
+ * super-frame.
+ */
+static uint8_t pkt_template[MAX_TX_LEN];
+
+/* One's complement sum of the TCP/UDP pseudo-header and the constant tail. */
+static uint32_t pkt_cksum_base;
+
+/* Bytes of one frame on the wire, FCS excluded. */
+static inline uint16_t
+pkt_data_len(void)
+{
+	return pkt_conf.frame_len - ETHER_CRC_LEN;
+}
+
+static inline uint16_t
+l4_hdr_len(void)
+{
+	return pkt_conf.proto == IPPROTO_TCP ? sizeof(struct tcp_hdr) :
+			sizeof(struct udp_hdr);
+}
+
+/*
+ * Headers and probe: the part of a frame written per packet, and all of
+ * the first segment of a chained one.
+ */
+static inline uint16_t
+pkt_head_len(void)
+{
+	return L4_HDR_OFFSET + l4_hdr_len() + sizeof(struct txrx_probe);
+}
+
+/* L4 payload of one frame on the wire, the MSS with TSO. */
+static inline uint16_t
+pkt_mss(void)
+{
+	return pkt_data_len() - L4_HDR_OFFSET - l4_hdr_len();
+}
 
+/* Length of what one TX mbuf (chain) carries: a frame or a super-frame. */
+static inline uint32_t
+pkt_tx_len(void)
+{
+	return L4_HDR_OFFSET + l4_hdr_len() +
+			(uint32_t) pkt_conf.tso_segs * pkt_mss();
 }
 
+static inline void
+l4_cksum_set(void *l4, uint16_t cksum)
+{
+	if (pkt_conf.proto == IPPROTO_TCP)
+		((struct tcp_hdr *) l4)->cksum = cksum;
+	else
+		((struct udp_hdr *) l4)->dgram_cksum = cksum;
+}
 
-static struct rte_mbuf * 
-alloc_pkt(struct rte_mempool *mbuf_pool)
+static void
+build_pkt_template(void)
 {
-	uint8_t payload[PAYLOAD_LEN]; // 64 bytes now
-	struct rte_mbuf *pkt;
+	const uint32_t tx_len = pkt_tx_len();
+	const uint16_t hdr_len = L4_HDR_OFFSET + l4_hdr_len();
+	const uint16_t head_len = pkt_head_len();
+	struct ether_hdr *eth = (struct ether_hdr *) pkt_template;
+	struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+	void *l4 = ip + 1;
+	uint8_t *payload = pkt_template + hdr_len;
+
+	ether_addr_copy(&pkt_conf.dst_mac, &eth->d_addr);
+	ether_addr_copy(&pkt_conf.src_mac, &eth->s_addr);
+	eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+	ip->version_ihl = 0x45;
+	ip->type_of_service = 0;
+	ip->total_length = rte_cpu_to_be_16(tx_len - sizeof(struct ether_hdr));
+	ip->packet_id = 0;
+	ip->fragment_offset = rte_cpu_to_be_16(IPV4_HDR_DF_FLAG);
+	ip->time_to_live = 64;
+	ip->next_proto_id = pkt_conf.proto;
+	ip->src_addr = rte_cpu_to_be_32(pkt_conf.src_ip);
+	ip->dst_addr = rte_cpu_to_be_32(pkt_conf.dst_ip);
+	ip->hdr_checksum = 0;
 
-	for (int i = 0; i < PAYLOAD_LEN; i++) {
+	if (pkt_conf.proto == IPPROTO_TCP) {
+		struct tcp_hdr *tcp = l4;
+
+		tcp->src_port = rte_cpu_to_be_16(pkt_conf.sport_min);
+		tcp->dst_port = rte_cpu_to_be_16(pkt_conf.dport_min);
+		tcp->sent_seq = 0;
+		tcp->recv_ack = 0;
+		tcp->data_off = (sizeof(*tcp) / 4) << 4;
+		tcp->tcp_flags = TCP_FLAGS_ACK_PSH;
+		tcp->rx_win = rte_cpu_to_be_16(UINT16_MAX);
+		tcp->cksum = 0;
+		tcp->tcp_urp = 0;
+	} else {
+		struct udp_hdr *udp = l4;
+
+		udp->src_port = rte_cpu_to_be_16(pkt_conf.sport_min);
+		udp->dst_port = rte_cpu_to_be_16(pkt_conf.dport_min);
+		udp->dgram_len = rte_cpu_to_be_16(tx_len - L4_HDR_OFFSET);
+		udp->dgram_cksum = 0;
+	}
+
+	RTE_BUILD_BUG_ON(TXRX_PROBE_OFFSET + sizeof(struct txrx_probe) +
+			ETHER_CRC_LEN > MIN_FRAME_LEN);
+
+	for (uint32_t i = 0; i < tx_len - hdr_len; i++) {
 		payload[i] = (uint8_t) i;
 	}
+	((struct txrx_probe *) payload)->magic = TXRX_PROBE_MAGIC;
+
+	/*
+	 * With offload the NIC wants the pseudo-header sum in the L4
+	 * checksum, which does not cover the ports and so holds for every
+	 * flow. Without it the IP header is summed here once, and the L4
+	 * sum is finished per packet from the sums of the pseudo-header and
+	 * of what follows the probe, which never change. UDP may also go
+	 * out without a checksum, which IPv4 allows.
+	 */
+	if (!(pkt_conf.tx_ol_flags & PKT_TX_IP_CKSUM))
+		ip->hdr_checksum = rte_ipv4_cksum(ip);
+	if (pkt_conf.tx_ol_flags & (PKT_TX_UDP_CKSUM | PKT_TX_TCP_CKSUM |
+			PKT_TX_TCP_SEG))
+		l4_cksum_set(l4, rte_ipv4_phdr_cksum(ip,
+				pkt_conf.tx_ol_flags));
+	else if (pkt_conf.sw_l4_cksum)
+		pkt_cksum_base = rte_ipv4_phdr_cksum(ip, 0) +
+				rte_raw_cksum(pkt_template + head_len,
+						tx_len - head_len);
+}
 
-	pkt = rte_pktmbuf_alloc(mbuf_pool);
-	if (pkt == NULL) {
-		rte_panic("Failed to allocate pkt fails\n");
+/*
+ * Finishes the UDP/TCP checksum of a frame in software: only the L4
+ * header and the probe, len bytes at l4, are summed per packet. The
+ * head is an even number of bytes, so the sums line up.
+ */
+static inline uint16_t
+pkt_l4_cksum_sw(const void *l4, uint16_t len)
+{
+	uint32_t sum = pkt_cksum_base + rte_raw_cksum(l4, len);
+	uint16_t cksum;
+
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	cksum = (uint16_t) ~sum;
+	/* zero is no checksum for UDP, all ones means the same sum */
+	return cksum == 0 ? 0xffff : cksum;
+}
+
+/*
+ * Mempool object iterator: copies the template into the data room of every
+ * TX mbuf once at startup, only the head if the payload is chained to it.
+ * The data survives free/alloc cycles, so the hot path never rewrites it.
+ */
+static void
+init_tx_mbuf(__attribute__((unused)) struct rte_mempool *mp,
+		__attribute__((unused)) void *opaque, void *obj,
+		__attribute__((unused)) unsigned obj_idx)
+{
+	struct rte_mbuf *m = obj;
+
+	rte_memcpy(rte_pktmbuf_mtod(m, void *), pkt_template,
+			pkt_conf.segs ? pkt_head_len() : pkt_tx_len());
+}
+
+/*
+ * Gets a full burst of pre-built frames from the TX pool with one bulk
+ * allocation. Per packet only the lengths, the offload flags, this
+ * lcore's next port pair, the TCP sequence number, the probe and, if the
+ * NIC does not, the L4 checksum are written. The probe is stamped with
+ * the TSC right before the burst goes to the NIC. With --segs every
+ * frame gets a reference to the lcore's read-only payload segment.
+ */
+static inline int
+alloc_burst(struct lcore_tx_ctx *ctx, struct rte_mbuf **bufs, unsigned nb_pkts)
+{
+	const uint32_t tx_len = pkt_tx_len();
+	const uint16_t head_len = pkt_head_len();
+	const uint16_t l4_len = l4_hdr_len();
+	const uint16_t mss = pkt_mss();
+	const uint32_t seq_step = (uint32_t) pkt_conf.tso_segs * mss;
+	const uint64_t ol_flags = pkt_conf.tx_ol_flags;
+	const int tcp = pkt_conf.proto == IPPROTO_TCP;
+	const int sw_cksum = pkt_conf.sw_l4_cksum;
+	struct rte_mbuf *payload = ctx->payload;
+	uint16_t sport = ctx->sport, dport = ctx->dport;
+	uint32_t flow = ctx->flow;
+	uint64_t tsc;
+
+	if (rte_pktmbuf_alloc_bulk(ctx->mbuf_pool, bufs, nb_pkts) != 0)
+		return -1;
+	if (payload != NULL)
+		rte_mbuf_refcnt_update(payload, nb_pkts);
+
+	tsc = rte_rdtsc();
+
+	for (unsigned i = 0; i < nb_pkts; i++) {
+		struct rte_mbuf *m = bufs[i];
+		struct txrx_probe *probe;
+		struct udp_hdr *l4;
+
+		m->pkt_len = tx_len;
+		if (payload != NULL) {
+			m->data_len = head_len;
+			m->next = payload;
+			m->nb_segs = 2;
+		} else {
+			m->data_len = tx_len;
+		}
+		if (ol_flags) {
+			m->ol_flags = ol_flags;
+			m->l2_len = sizeof(struct ether_hdr);
+			m->l3_len = sizeof(struct ipv4_hdr);
+			m->l4_len = l4_len;
+			m->tso_segsz = mss;
+		}
+		/* TCP has its ports at the same place */
+		l4 = rte_pktmbuf_mtod_offset(m, struct udp_hdr *, L4_HDR_OFFSET);
+		l4->src_port = rte_cpu_to_be_16(sport);
+		l4->dst_port = rte_cpu_to_be_16(dport);
+		probe = (struct txrx_probe *) ((uint8_t *) l4 + l4_len);
+		probe->tsc = tsc;
+		probe->seq = ctx->seq[flow]++;
+		if (tcp)
+			((struct tcp_hdr *) l4)->sent_seq =
+					rte_cpu_to_be_32(probe->seq * seq_step);
+		if (sw_cksum) {
+			l4_cksum_set(l4, 0);
+			l4_cksum_set(l4, pkt_l4_cksum_sw(l4,
+					head_len - L4_HDR_OFFSET));
+		}
+
+		/* source port first, then carry into the destination port */
+		if (sport != ctx->sport_hi) {
+			sport++;
+		} else {
+			sport = ctx->sport_lo;
+			dport = dport == pkt_conf.dport_max ?
+					pkt_conf.dport_min : dport + 1;
+		}
+		if (++flow == ctx->nb_flows)
+			flow = 0;
+	}
+	ctx->sport = sport;
+	ctx->dport = dport;
+	ctx->flow = flow;
+
+	return 0;
+}
+
+/* Average frame size on the wire, FCS included, for the Gbit/s figures. */
+static double
+pace_frame_len(void)
+{
+	if (replay_conf.path != NULL)
+		return (double) replay.bytes / replay.nb_pkts + ETHER_CRC_LEN;
+	return pkt_conf.frame_len;
+}
+
+/*
+ * Requested packet rate of the whole port, or 0 when unpaced. The gap mode
+ * is per queue, so it scales with the number of TX queues.
+ */
+static double
+pace_target_pps(uint16_t nb_txq)
+{
+	switch (pace_conf.mode) {
+	case PACE_PPS:
+		return pace_conf.value;
+	case PACE_GBPS:
+		return pace_conf.value * 1e9 /
+			((pace_frame_len() + ETHER_L1_OVERHEAD) * 8);
+	case PACE_GAP:
+		return (double) txrx_conf.burst * pkt_conf.tso_segs * nb_txq *
+			1e9 / pace_conf.value;
+	default:
+		return 0;
 	}
-	
-	rte_memcpy(rte_pktmbuf_mtod_offset(pkt, char *, 0), payload, (size_t) sizeof(payload) );
+}
+
+/* Sets up a TX lcore's token bucket for its share of the port rate. */
+static void
+pacer_init(struct tx_pacer *p, double pps)
+{
+	memset(p, 0, sizeof(*p));
+	if (pps <= 0)
+		return;
+	p->cost = (uint64_t) ((double) txrx_tsc_hz / pps *
+			(1ULL << PACE_SHIFT));
+	if (p->cost == 0)
+		p->cost = 1;
+	p->depth = p->cost * txrx_conf.burst * pkt_conf.tso_segs * PACE_DEPTH;
+	p->last_tsc = rte_rdtsc();
+}
 
-	if(rte_pktmbuf_append(pkt, (uint16_t) PAYLOAD_LEN) == NULL){
-		rte_panic("Failed to append to mbuf\n");
-        rte_pktmbuf_free(pkt);
-        return NULL;
+/*
+ * Spins until the bucket holds enough credit for nb_pkts packets and takes
+ * it. Returns immediately for an unpaced lcore, and without the credit
+ * when the run is over.
+ */
+static inline void
+pacer_wait(struct tx_pacer *p, uint32_t nb_pkts)
+{
+	const uint64_t need = p->cost * nb_pkts;
+
+	if (p->cost == 0)
+		return;
+
+	for (;;) {
+		const uint64_t now = rte_rdtsc();
+
+		p->credit += (now - p->last_tsc) << PACE_SHIFT;
+		p->last_tsc = now;
+		if (p->credit > p->depth)
+			p->credit = p->depth;
+		if (p->credit >= need)
+			break;
+		if (unlikely(txrx_quit))
+			return;
+		rte_pause();
 	}
+	p->credit -= need;
+}
 
-	return pkt;
+/* Gives back the credit of packets the TX queue did not take. */
+static inline void
+pacer_refund(struct tx_pacer *p, uint16_t nb_pkts)
+{
+	p->credit += p->cost * nb_pkts;
+}
+
+/* Parses "lo" or "lo-hi" into a port range. */
+static int
+parse_port_range(const char *arg, uint16_t *lo, uint16_t *hi)
+{
+	unsigned long min, max;
+	char *end;
+
+	min = strtoul(arg, &end, 10);
+	if (end == arg || min > UINT16_MAX)
+		return -1;
+	max = min;
+	if (*end == '-') {
+		arg = end + 1;
+		max = strtoul(arg, &end, 10);
+		if (end == arg || max > UINT16_MAX || max < min)
+			return -1;
+	}
+	if (*end != '\0')
+		return -1;
+
+	*lo = (uint16_t) min;
+	*hi = (uint16_t) max;
+	return 0;
+}
+
+static int
+parse_mac(const char *arg, struct ether_addr *addr)
+{
+	uint8_t *b = addr->addr_bytes;
+	char c;
+
+	if (sscanf(arg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c",
+			&b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &c) != 6)
+		return -1;
+	return 0;
+}
+
+static int
+parse_ipv4(const char *arg, uint32_t *addr)
+{
+	struct in_addr in;
+
+	if (inet_pton(AF_INET, arg, &in) != 1)
+		return -1;
+	*addr = rte_be_to_cpu_32(in.s_addr);
+	return 0;
+}
+
+static void
+print_usage(const char *prgname)
+{
+	printf("%s [EAL options] -- [-s FRAME_SIZE] [--src-mac MAC]\n"
+		"    [--dst-mac MAC] [--src-ip IP] [--dst-ip IP]\n"
+		"    [--sport LO[-HI]] [--dport LO[-HI]]\n"
+		"    [--pps RATE | --gbps RATE | --gap NS] [--bursts N]\n"
+		"    [--tcp] [--tso N] [--segs] [--cksum auto|sw|off]\n"
+		"    [--pcap FILE [--pcap-speed F] [--pcap-loops N]]\n"
+		"    [common options]\n"
+		"  -s FRAME_SIZE: frame size in bytes incl. FCS, %u-%u (default %u)\n"
+		"  --src-mac MAC: source MAC (default: port MAC)\n"
+		"  --dst-mac MAC: destination MAC (default: broadcast)\n"
+		"  --src-ip IP, --dst-ip IP: IPv4 addresses\n"
+		"  --sport LO[-HI]: source port range, split between TX lcores,\n"
+		"      at least one port each\n"
+		"  --dport LO[-HI]: destination port range\n"
+		"  --pps RATE: pace the port to RATE packets/s\n"
+		"  --gbps RATE: pace the port to RATE Gbit/s, L1 overhead included\n"
+		"  --gap NS: pace every TX queue to one burst per NS nanoseconds\n"
+		"  --bursts N: bursts per TX lcore, 0 for no limit (default %u,\n"
+		"      none with --duration or --count)\n"
+		"  --tcp: send TCP segments instead of UDP datagrams\n"
+		"  --tso N: hand the NIC TCP super-frames it cuts into N frames\n"
+		"      of FRAME_SIZE, 2-%u (implies --tcp and --segs)\n"
+		"  --segs: headers and payload in separate, chained mbufs\n"
+		"  --cksum auto|sw|off: UDP/TCP checksums by the NIC where it\n"
+		"      can and in software otherwise, always in software, or\n"
+		"      none (UDP only) (default auto)\n"
+		"  --pcap FILE: replay the packets of a pcap file instead, MACs\n"
+		"      rewritten only if --src-mac or --dst-mac is given\n"
+		"  --pcap-speed F: at F times the captured speed, 0 for as fast\n"
+		"      as --pps, --gbps or --gap allow (default 1)\n"
+		"  --pcap-loops N: times to replay the file, 0 for no limit\n"
+		"      (default 1)\n",
+		prgname, MIN_FRAME_LEN, MAX_FRAME_LEN, DEF_FRAME_LEN, DEF_BURSTS,
+		TSO_MAX_SEGS);
+	txrx_conf_usage();
+}
+
+#define CMD_LINE_OPT_SRC_MAC "src-mac"
+#define CMD_LINE_OPT_DST_MAC "dst-mac"
+#define CMD_LINE_OPT_SRC_IP "src-ip"
+#define CMD_LINE_OPT_DST_IP "dst-ip"
+#define CMD_LINE_OPT_SPORT "sport"
+#define CMD_LINE_OPT_DPORT "dport"
+#define CMD_LINE_OPT_PPS "pps"
+#define CMD_LINE_OPT_GBPS "gbps"
+#define CMD_LINE_OPT_GAP "gap"
+#define CMD_LINE_OPT_BURSTS "bursts"
+#define CMD_LINE_OPT_TCP "tcp"
+#define CMD_LINE_OPT_TSO "tso"
+#define CMD_LINE_OPT_SEGS "segs"
+#define CMD_LINE_OPT_CKSUM "cksum"
+#define CMD_LINE_OPT_PCAP "pcap"
+#define CMD_LINE_OPT_PCAP_SPEED "pcap-speed"
+#define CMD_LINE_OPT_PCAP_LOOPS "pcap-loops"
+
+enum {
+	/* long options mapped to a short option */
+	CMD_LINE_OPT_MIN_NUM = 256,
+	CMD_LINE_OPT_SRC_MAC_NUM,
+	CMD_LINE_OPT_DST_MAC_NUM,
+	CMD_LINE_OPT_SRC_IP_NUM,
+	CMD_LINE_OPT_DST_IP_NUM,
+	CMD_LINE_OPT_SPORT_NUM,
+	CMD_LINE_OPT_DPORT_NUM,
+	CMD_LINE_OPT_PPS_NUM,
+	CMD_LINE_OPT_GBPS_NUM,
+	CMD_LINE_OPT_GAP_NUM,
+	CMD_LINE_OPT_BURSTS_NUM,
+	CMD_LINE_OPT_TCP_NUM,
+	CMD_LINE_OPT_TSO_NUM,
+	CMD_LINE_OPT_SEGS_NUM,
+	CMD_LINE_OPT_CKSUM_NUM,
+	CMD_LINE_OPT_PCAP_NUM,
+	CMD_LINE_OPT_PCAP_SPEED_NUM,
+	CMD_LINE_OPT_PCAP_LOOPS_NUM,
+};
+
+static const char short_options[] = "s:";
+
+static const struct option lgopts[] = {
+	{ CMD_LINE_OPT_SRC_MAC, required_argument, NULL, CMD_LINE_OPT_SRC_MAC_NUM },
+	{ CMD_LINE_OPT_DST_MAC, required_argument, NULL, CMD_LINE_OPT_DST_MAC_NUM },
+	{ CMD_LINE_OPT_SRC_IP, required_argument, NULL, CMD_LINE_OPT_SRC_IP_NUM },
+	{ CMD_LINE_OPT_DST_IP, required_argument, NULL, CMD_LINE_OPT_DST_IP_NUM },
+	{ CMD_LINE_OPT_SPORT, required_argument, NULL, CMD_LINE_OPT_SPORT_NUM },
+	{ CMD_LINE_OPT_DPORT, required_argument, NULL, CMD_LINE_OPT_DPORT_NUM },
+	{ CMD_LINE_OPT_PPS, required_argument, NULL, CMD_LINE_OPT_PPS_NUM },
+	{ CMD_LINE_OPT_GBPS, required_argument, NULL, CMD_LINE_OPT_GBPS_NUM },
+	{ CMD_LINE_OPT_GAP, required_argument, NULL, CMD_LINE_OPT_GAP_NUM },
+	{ CMD_LINE_OPT_BURSTS, required_argument, NULL, CMD_LINE_OPT_BURSTS_NUM },
+	{ CMD_LINE_OPT_TCP, no_argument, NULL, CMD_LINE_OPT_TCP_NUM },
+	{ CMD_LINE_OPT_TSO, required_argument, NULL, CMD_LINE_OPT_TSO_NUM },
+	{ CMD_LINE_OPT_SEGS, no_argument, NULL, CMD_LINE_OPT_SEGS_NUM },
+	{ CMD_LINE_OPT_CKSUM, required_argument, NULL, CMD_LINE_OPT_CKSUM_NUM },
+	{ CMD_LINE_OPT_PCAP, required_argument, NULL, CMD_LINE_OPT_PCAP_NUM },
+	{ CMD_LINE_OPT_PCAP_SPEED, required_argument, NULL,
+		CMD_LINE_OPT_PCAP_SPEED_NUM },
+	{ CMD_LINE_OPT_PCAP_LOOPS, required_argument, NULL,
+		CMD_LINE_OPT_PCAP_LOOPS_NUM },
+	TXRX_CONF_LGOPTS,
+	{ NULL, 0, 0, 0 }
+};
+
+/* Parses the value of one of the mutually exclusive pacing options. */
+static int
+parse_pace(const char *arg, enum pace_mode mode)
+{
+	char *end;
+	double v;
+
+	if (pace_conf.mode != PACE_NONE) {
+		printf("only one of --pps, --gbps and --gap can be given\n");
+		return -1;
+	}
+	v = strtod(arg, &end);
+	if (end == arg || *end != '\0' || v <= 0) {
+		printf("invalid rate %s\n", arg);
+		return -1;
+	}
+	pace_conf.mode = mode;
+	pace_conf.value = v;
+	return 0;
+}
+
+/* Parses the application arguments left over after the EAL ones. */
+static int
+parse_args(int argc, char **argv)
+{
+	char *prgname = argv[0];
+	unsigned long n;
+	char *end;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, short_options,
+			lgopts, NULL)) != EOF) {
+		switch (opt) {
+		case 's':
+			n = strtoul(optarg, &end, 10);
+			if (*end != '\0' || n < MIN_FRAME_LEN || n > MAX_FRAME_LEN) {
+				printf("invalid frame size %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			pkt_conf.frame_len = (uint16_t) n;
+			break;
+		case CMD_LINE_OPT_SRC_MAC_NUM:
+			if (parse_mac(optarg, &pkt_conf.src_mac) < 0) {
+				printf("invalid source MAC %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			pkt_conf.src_mac_set = 1;
+			break;
+		case CMD_LINE_OPT_DST_MAC_NUM:
+			if (parse_mac(optarg, &pkt_conf.dst_mac) < 0) {
+				printf("invalid destination MAC %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			pkt_conf.dst_mac_set = 1;
+			break;
+		case CMD_LINE_OPT_SRC_IP_NUM:
+			if (parse_ipv4(optarg, &pkt_conf.src_ip) < 0) {
+				printf("invalid source IP %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_DST_IP_NUM:
+			if (parse_ipv4(optarg, &pkt_conf.dst_ip) < 0) {
+				printf("invalid destination IP %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_SPORT_NUM:
+			if (parse_port_range(optarg, &pkt_conf.sport_min,
+					&pkt_conf.sport_max) < 0) {
+				printf("invalid source port range %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_DPORT_NUM:
+			if (parse_port_range(optarg, &pkt_conf.dport_min,
+					&pkt_conf.dport_max) < 0) {
+				printf("invalid destination port range %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_PPS_NUM:
+		case CMD_LINE_OPT_GBPS_NUM:
+		case CMD_LINE_OPT_GAP_NUM:
+			if (parse_pace(optarg, opt == CMD_LINE_OPT_PPS_NUM ? PACE_PPS :
+					opt == CMD_LINE_OPT_GBPS_NUM ? PACE_GBPS :
+					PACE_GAP) < 0) {
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_BURSTS_NUM:
+			n = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0') {
+				printf("invalid burst count %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			nb_bursts = n;
+			nb_bursts_set = 1;
+			break;
+		case CMD_LINE_OPT_TCP_NUM:
+			pkt_conf.proto = IPPROTO_TCP;
+			break;
+		case CMD_LINE_OPT_TSO_NUM:
+			n = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || n < 2 ||
+					n > TSO_MAX_SEGS) {
+				printf("invalid TSO frame count %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			pkt_conf.tso_segs = n;
+			pkt_conf.proto = IPPROTO_TCP;
+			pkt_conf.segs = 1;
+			break;
+		case CMD_LINE_OPT_SEGS_NUM:
+			pkt_conf.segs = 1;
+			break;
+		case CMD_LINE_OPT_CKSUM_NUM:
+			for (n = 0; n < RTE_DIM(cksum_mode_names); n++) {
+				if (strcmp(optarg, cksum_mode_names[n]) == 0)
+					break;
+			}
+			if (n == RTE_DIM(cksum_mode_names)) {
+				printf("invalid checksum mode %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			pkt_conf.cksum = n;
+			break;
+		case CMD_LINE_OPT_PCAP_NUM:
+			replay_conf.path = optarg;
+			break;
+		case CMD_LINE_OPT_PCAP_SPEED_NUM:
+			replay_conf.speed = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0' ||
+					!(replay_conf.speed >= 0)) {
+				printf("invalid replay speed %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		case CMD_LINE_OPT_PCAP_LOOPS_NUM:
+			n = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0') {
+				printf("invalid replay loop count %s\n", optarg);
+				print_usage(prgname);
+				return -1;
+			}
+			replay_conf.loops = n;
+			break;
+		default:
+			if (txrx_conf_parse(opt, optarg) != 0) {
+				print_usage(prgname);
+				return -1;
+			}
+			break;
+		}
+	}
+
+	if (!nb_bursts_set && (txrx_conf.duration != 0 || txrx_conf.count != 0))
+		nb_bursts = 0;
+
+	/* A replay sends the capture as is, whatever the packet options. */
+	if (replay_conf.path != NULL) {
+		if (replay_conf.speed > 0 && pace_conf.mode != PACE_NONE) {
+			printf("--pps, --gbps and --gap need --pcap-speed 0\n");
+			return -1;
+		}
+		if (!nb_bursts_set)
+			nb_bursts = 0;
+		pkt_conf.proto = IPPROTO_UDP;
+		pkt_conf.tso_segs = 1;
+		pkt_conf.segs = 0;
+		pkt_conf.cksum = CKSUM_OFF;
+	}
+
+	if (pkt_conf.proto == IPPROTO_TCP) {
+		const unsigned min_len = TXRX_PROBE_OFFSET_TCP +
+				sizeof(struct txrx_probe) + ETHER_CRC_LEN;
+
+		if (pkt_conf.frame_len < min_len) {
+			printf("TCP frames need at least %u bytes\n", min_len);
+			return -1;
+		}
+		if (pkt_conf.cksum == CKSUM_OFF) {
+			printf("TCP cannot go without checksums\n");
+			return -1;
+		}
+	}
+	if (pkt_tx_len() > MAX_TX_LEN) {
+		printf("%u frames of %u bytes do not fit a TSO super-frame\n",
+				pkt_conf.tso_segs, pkt_conf.frame_len);
+		return -1;
+	}
+	if (pkt_conf.segs && pkt_tx_len() == pkt_head_len()) {
+		printf("--segs needs frames longer than their headers and "
+				"probe, %u bytes\n", pkt_head_len() + ETHER_CRC_LEN);
+		return -1;
+	}
+	/* every frame in flight holds a reference to the payload segment */
+	if (pkt_conf.segs &&
+			txrx_conf.tx_ring_size + txrx_conf.burst >= UINT16_MAX) {
+		printf("--segs needs fewer than %u TX descriptors\n",
+				UINT16_MAX - txrx_conf.burst);
+		return -1;
+	}
+
+	if (optind >= 0)
+		argv[optind-1] = prgname;
+
+	optind = 1; /* reset getopt lib */
+	return 0;
 }
 
 
 /*
  * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * coming from the mbuf_pool passed as a parameter. One TX queue is set up
+ * for each of the tx_rings TX lcores.
  */
 static inline int
-port_init(uint8_t port, struct rte_mempool *mbuf_pool)
+port_init(uint8_t port, struct rte_mempool *mbuf_pool, uint16_t tx_rings)
 {
 	struct rte_eth_conf port_conf = port_conf_default;
-	const uint16_t rx_rings = 1, tx_rings = 1;
+	struct rte_eth_dev_info dev_info;
+	struct rte_eth_txconf txconf;
+	const int tcp = pkt_conf.proto == IPPROTO_TCP;
+	const uint16_t rx_rings = 1;
+	uint32_t capa, tso_capa, l4_capa;
 	int retval;
 	uint16_t q;
 
 	if (port >= rte_eth_dev_count())
 		return -1;
 
+	rte_eth_dev_info_get(port, &dev_info);
+	if (tx_rings > dev_info.max_tx_queues) {
+		printf("Port %u supports only %u TX queues, %u requested\n",
+				(unsigned)port, dev_info.max_tx_queues,
+				(unsigned)tx_rings);
+		return -1;
+	}
+
+	if (pkt_conf.frame_len > ETHER_MAX_LEN) {
+		if (pkt_conf.frame_len > dev_info.max_rx_pktlen) {
+			printf("Port %u supports frames up to %u bytes only\n",
+					(unsigned)port, dev_info.max_rx_pktlen);
+			return -1;
+		}
+		port_conf.rxmode.jumbo_frame = 1;
+		port_conf.rxmode.max_rx_pkt_len = pkt_conf.frame_len;
+	}
+
+	/*
+	 * Let the NIC fill in the IPv4 and UDP/TCP checksums and cut TSO
+	 * super-frames when it can. Checksums it cannot do are done in
+	 * software; TSO and chained mbufs have no stand-in, without them
+	 * frames go out whole and one by one. Default TX queue settings of
+	 * many PMDs disable offloads and multi-segment mbufs, so re-enable
+	 * them on the queues too.
+	 */
+	capa = dev_info.tx_offload_capa;
+	tso_capa = DEV_TX_OFFLOAD_TCP_TSO | DEV_TX_OFFLOAD_IPV4_CKSUM |
+			DEV_TX_OFFLOAD_TCP_CKSUM;
+	l4_capa = tcp ? DEV_TX_OFFLOAD_TCP_CKSUM : DEV_TX_OFFLOAD_UDP_CKSUM;
+#ifdef DEV_TX_OFFLOAD_MULTI_SEGS
+	if (pkt_conf.segs && !(capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+		printf("Port %u cannot send chained mbufs, sending whole "
+				"frames\n", (unsigned)port);
+		pkt_conf.segs = 0;
+	}
+#endif
+	if (pkt_conf.tso_segs > 1 &&
+			(!pkt_conf.segs || (capa & tso_capa) != tso_capa)) {
+		printf("Port %u has no TSO, sending the %u byte frames one "
+				"by one\n", (unsigned)port, pkt_conf.frame_len);
+		pkt_conf.tso_segs = 1;
+	}
+
+	pkt_conf.tx_ol_flags = 0;
+	pkt_conf.sw_l4_cksum = 0;
+	if (pkt_conf.tso_segs > 1) {
+		pkt_conf.tx_ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM |
+				PKT_TX_TCP_SEG;
+	} else if (pkt_conf.cksum == CKSUM_AUTO) {
+		if (capa & DEV_TX_OFFLOAD_IPV4_CKSUM)
+			pkt_conf.tx_ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+		if (capa & l4_capa)
+			pkt_conf.tx_ol_flags |= PKT_TX_IPV4 |
+					(tcp ? PKT_TX_TCP_CKSUM : PKT_TX_UDP_CKSUM);
+		else
+			pkt_conf.sw_l4_cksum = 1;
+	} else if (pkt_conf.cksum == CKSUM_SW) {
+		pkt_conf.sw_l4_cksum = 1;
+	}
+
+	txconf = dev_info.default_txconf;
+	if (pkt_conf.tx_ol_flags)
+		txconf.txq_flags &= ~(ETH_TXQ_FLAGS_NOXSUMUDP |
+				ETH_TXQ_FLAGS_NOXSUMTCP | ETH_TXQ_FLAGS_NOXSUMSCTP);
+	/* the payload segment comes from another pool and is shared */
+	if (pkt_conf.segs)
+		txconf.txq_flags &= ~(ETH_TXQ_FLAGS_NOMULTSEGS |
+				ETH_TXQ_FLAGS_NOREFCOUNT | ETH_TXQ_FLAGS_NOMULTMEMP);
+	/* replayed mbufs go out again and again, holding references */
+	if (replay_conf.path != NULL)
+		txconf.txq_flags &= ~(ETH_TXQ_FLAGS_NOREFCOUNT |
+				ETH_TXQ_FLAGS_NOMULTMEMP);
+	else
+		printf("Port %u checksums: IPv4 %s, %s %s\n", (unsigned)port,
+				pkt_conf.tx_ol_flags & PKT_TX_IP_CKSUM ?
+				"hw" : "sw", tcp ? "TCP" : "UDP",
+				pkt_conf.tx_ol_flags & (PKT_TX_UDP_CKSUM |
+				PKT_TX_TCP_CKSUM | PKT_TX_TCP_SEG) ? "hw" :
+				pkt_conf.sw_l4_cksum ? "sw" : "off");
+	if (pkt_conf.tso_segs > 1)
+		printf("Port %u TSO: %u frames with %u byte segments per "
+				"mbuf\n", (unsigned)port, pkt_conf.tso_segs,
+				pkt_mss());
+
 	/* Configure the Ethernet device. */
 	retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
 	if (retval != 0)
 		return retval;
 
+	if (port_conf.rxmode.jumbo_frame) {
+		retval = rte_eth_dev_set_mtu(port, pkt_conf.frame_len -
+				ETHER_HDR_LEN - ETHER_CRC_LEN);
+		if (retval != 0 && retval != -ENOTSUP)
+			return retval;
+	}
+
 	/* Allocate and set up 1 RX queue per Ethernet port. */
 	for (q = 0; q < rx_rings; q++) {
-		retval = rte_eth_rx_queue_setup(port, q, RX_RING_SIZE,
+		retval = rte_eth_rx_queue_setup(port, q, txrx_conf.rx_ring_size,
 				rte_eth_dev_socket_id(port), NULL, mbuf_pool);
 		if (retval < 0)
 			return retval;
 	}
 
-	/* Allocate and set up 1 TX queue per Ethernet port. */
+	/* Allocate and set up 1 TX queue per TX lcore. */
 	for (q = 0; q < tx_rings; q++) {
-		retval = rte_eth_tx_queue_setup(port, q, TX_RING_SIZE,
-				rte_eth_dev_socket_id(port), NULL);
+		retval = rte_eth_tx_queue_setup(port, q, txrx_conf.tx_ring_size,
+				rte_eth_dev_socket_id(port), &txconf);
 		if (retval < 0)
 			return retval;
 	}
@@ -172,62 +1143,613 @@ port_init(uint8_t port, struct rte_mempool *mbuf_pool)
 	return 0;
 }
 
+/* Starts the counters over at the end of the warm-up, on the TX lcore. */
+static void
+lcore_tx_restart(struct lcore_tx_ctx *ctx)
+{
+	ctx->bursts = 0;
+	ctx->tx_pkts = 0;
+	ctx->tx_bytes = 0;
+	ctx->tx_dropped = 0;
+	/* a replay starts over from the first packet */
+	ctx->replay.pos = 0;
+	ctx->replay.loops = 0;
+	ctx->replay.base_tsc = rte_rdtsc();
+	txrx_poll_reset(&ctx->poll);
+	txrx_epoch_ack(&ctx->epoch);
+}
+
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * The TX loop. Each TX lcore runs it on its own queue with its own flow set,
+ * so no state is shared between lcores while sending. Counters are in
+ * frames on the wire, a TSO super-frame counts as the frames it is cut
+ * into.
  */
-static __attribute__((noreturn)) void
-lcore_main(uint8_t tx_port, struct rte_mempool *mbuf_pool)
+static int
+lcore_tx(void *arg)
 {
-	const uint8_t nb_ports = rte_eth_dev_count();
-	uint8_t port;
+	struct lcore_tx_ctx *ctx = arg;
+	const uint16_t burst = txrx_conf.burst;
+	const uint16_t frames = pkt_conf.tso_segs;
+
+	txrx_check_lcore_socket(rte_lcore_id(), ctx->port);
 
-	 /*Check that the port is on the same NUMA node as the polling thread
-	 * for best performance*/
-	for (port = 0; port < nb_ports; port++)
-		if (rte_eth_dev_socket_id(port) > 0 &&
-				rte_eth_dev_socket_id(port) !=
-						(int)rte_socket_id())
-			printf("WARNING, port %u is on remote NUMA node to "
-					"polling thread.\n\tPerformance will "
-					"not be optimal.\n", port);
-
-	printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-			rte_lcore_id());
-	
-	if (nb_ports != 1)
-		rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
-
-
-	uint64_t send_count=0;
-	uint64_t start_time=get_ns_time();
-	/* Run until the application is quit or killed. */
-	//for (;;) {
-	for(int j = 0; j < 65536; j++){
+	printf("\nCore %u sending packets on queue %u, %s source ports "
+			"%u-%u.\n", rte_lcore_id(), ctx->queue,
+			pkt_conf.proto == IPPROTO_TCP ? "TCP" : "UDP",
+			ctx->sport_lo, ctx->sport_hi);
+
+	txrx_wait_go();
+	ctx->pacer.last_tsc = rte_rdtsc();
+
+	/*
+	 * Run until the burst count or the duration is reached. Bursts sent
+	 * during the warm-up do not count, an lcore that left early would
+	 * never acknowledge its end.
+	 */
+	txrx_poll_loop_begin(&ctx->poll);
+	while (!txrx_quit) {
 		/* Get burst of RX packets */
-		struct rte_mbuf *bufs[BURST_SIZE];
-		
-		for (int i = 0; i < BURST_SIZE; i++) {
-			bufs[i] = alloc_pkt(mbuf_pool);
-			if(bufs[i] == NULL){
-				rte_exit(EXIT_FAILURE, "allocating pkt fails\n");
-			}
-		}
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_tx_restart(ctx);
+		if (nb_bursts != 0 && ctx->bursts == nb_bursts &&
+				(txrx_conf.warmup == 0 || ctx->epoch != 0))
+			break;
+		ctx->bursts++;
+
+		pacer_wait(&ctx->pacer, burst * frames);
+		if (alloc_burst(ctx, bufs, burst) != 0)
+			rte_exit(EXIT_FAILURE, "allocating pkt fails\n");
 		/* pull mode devices, so most the time nb_rx can be 0 */ 
-		const uint16_t nb_tx = rte_eth_tx_burst(tx_port, 0, bufs, BURST_SIZE);
-		send_count +=(uint64_t)nb_tx;
-		if(nb_tx>0 && send_count%32 == 0)
-			printf("Burst# %" PRIu64 "\n", send_count/32);
-		if (unlikely(nb_tx < BURST_SIZE)) {
+		const uint64_t poll_tsc = txrx_poll_start();
+		const uint16_t nb_tx = rte_eth_tx_burst(ctx->port, ctx->queue,
+				bufs, burst);
+		txrx_poll_end(&ctx->poll.tx, poll_tsc, nb_tx, burst);
+		ctx->tx_pkts += (uint64_t)nb_tx * frames;
+		ctx->tx_bytes += (uint64_t)nb_tx * frames * pkt_data_len();
+		if (unlikely(nb_tx < burst)) {
                 	uint16_t buf_num;
-                	for (buf_num = nb_tx; buf_num < BURST_SIZE; buf_num++)
+			ctx->tx_dropped += (burst - nb_tx) * frames;
+			pacer_refund(&ctx->pacer, (burst - nb_tx) * frames);
+                	for (buf_num = nb_tx; buf_num < burst; buf_num++)
                 		 rte_pktmbuf_free(bufs[buf_num]);
             	}
 	}
-	
-	uint64_t end_time=get_ns_time();
-	print_eth_stats(tx_port, end_time-start_time, send_count);
-    
+	txrx_poll_loop_end(&ctx->poll);
+
+	if (rte_atomic32_dec_and_test(&tx_running))
+		txrx_quit = 1;
+	return 0;
+}
+
+/*
+ * Reads the capture in two passes: one to size the pool, one to fill it.
+ * Frames the port could not send are skipped. The largest frame becomes
+ * the frame size, for the port's MTU.
+ */
+static struct rte_mempool *
+replay_load(unsigned socket)
+{
+	struct txrx_pcap_reader r;
+	struct pcap_rec_hdr rec;
+	struct rte_mempool *pool;
+	uint32_t nb = 0, max_len = 0, skipped = 0;
+	uint64_t ts_ns, first_ns = 0;
+	int ret;
+
+	if (txrx_pcap_open(&r, replay_conf.path) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot replay %s\n", replay_conf.path);
+	while ((ret = txrx_pcap_next(&r, &rec, &ts_ns)) > 0) {
+		if (txrx_pcap_data(&r, &rec, NULL) != 0)
+			break;
+		if (rec.caplen < sizeof(struct ether_hdr) ||
+				rec.caplen + ETHER_CRC_LEN > MAX_FRAME_LEN) {
+			skipped++;
+			continue;
+		}
+		nb++;
+		max_len = RTE_MAX(max_len, rec.caplen);
+	}
+	if (ret < 0)
+		printf("%s: truncated, replaying what is there\n",
+				replay_conf.path);
+	if (nb == 0)
+		rte_exit(EXIT_FAILURE, "%s: no packets to replay\n",
+				replay_conf.path);
+
+	replay.pkts = rte_zmalloc_socket("replay_pkts",
+			nb * sizeof(*replay.pkts), RTE_CACHE_LINE_SIZE, socket);
+	replay.ts_ns = rte_zmalloc_socket("replay_ts",
+			nb * sizeof(*replay.ts_ns), RTE_CACHE_LINE_SIZE, socket);
+	if (replay.pkts == NULL || replay.ts_ns == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate replay tables\n");
+	pool = txrx_socket_pool("PCAP_POOL", socket, nb, 0,
+			max_len + RTE_PKTMBUF_HEADROOM);
+
+	txrx_pcap_rewind(&r);
+	while (replay.nb_pkts < nb && txrx_pcap_next(&r, &rec, &ts_ns) > 0) {
+		struct rte_mbuf *m;
+
+		if (rec.caplen < sizeof(struct ether_hdr) ||
+				rec.caplen + ETHER_CRC_LEN > MAX_FRAME_LEN) {
+			if (txrx_pcap_data(&r, &rec, NULL) != 0)
+				break;
+			continue;
+		}
+		m = rte_pktmbuf_alloc(pool);
+		if (m == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate replay mbuf\n");
+		if (txrx_pcap_data(&r, &rec, rte_pktmbuf_mtod(m, void *)) != 0) {
+			rte_pktmbuf_free(m);
+			break;
+		}
+		m->data_len = rec.caplen;
+		m->pkt_len = rec.caplen;
+		if (pkt_conf.src_mac_set)
+			ether_addr_copy(&pkt_conf.src_mac, &rte_pktmbuf_mtod(m,
+					struct ether_hdr *)->s_addr);
+		if (pkt_conf.dst_mac_set)
+			ether_addr_copy(&pkt_conf.dst_mac, &rte_pktmbuf_mtod(m,
+					struct ether_hdr *)->d_addr);
+
+		if (replay.nb_pkts == 0)
+			first_ns = ts_ns;
+		ts_ns = ts_ns > first_ns ? ts_ns - first_ns : 0;
+		if (replay.nb_pkts != 0 &&
+				ts_ns < replay.ts_ns[replay.nb_pkts - 1])
+			ts_ns = replay.ts_ns[replay.nb_pkts - 1];
+		replay.ts_ns[replay.nb_pkts] = ts_ns;
+		replay.pkts[replay.nb_pkts++] = m;
+		replay.bytes += rec.caplen;
+	}
+	txrx_pcap_close(&r);
+
+	replay.span_ns = replay.ts_ns[replay.nb_pkts - 1];
+	pkt_conf.frame_len = RTE_MAX(max_len + ETHER_CRC_LEN,
+			(uint32_t) MIN_FRAME_LEN);
+	printf("%s: %u packets, %" PRIu64 " bytes over %.3fs, %.0f bytes "
+			"on average, largest %u", replay_conf.path,
+			replay.nb_pkts, replay.bytes,
+			(double) replay.span_ns / NS_PER_S,
+			(double) replay.bytes / replay.nb_pkts, max_len);
+	if (skipped != 0)
+		printf(", %u skipped", skipped);
+	printf("\n");
+	return pool;
+}
+
+/*
+ * TX queue of a replayed packet. Packets of one flow (IPv4 addresses,
+ * protocol and ports, or MAC addresses for anything else) stay on one
+ * queue, so they go out in capture order.
+ */
+static uint16_t
+replay_queue(const struct rte_mbuf *m, uint16_t nb_txq)
+{
+	const struct ether_hdr *eth = rte_pktmbuf_mtod(m,
+			const struct ether_hdr *);
+	const struct ipv4_hdr *ip = (const struct ipv4_hdr *) (eth + 1);
+	struct {
+		uint32_t src_ip;
+		uint32_t dst_ip;
+		uint32_t ports;
+		uint32_t proto;
+	} key;
+
+	if (nb_txq == 1)
+		return 0;
+	if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+			m->data_len < sizeof(*eth) + sizeof(*ip) +
+			sizeof(key.ports))
+		return rte_hash_crc(eth, 2 * ETHER_ADDR_LEN, 0) % nb_txq;
+
+	memset(&key, 0, sizeof(key));
+	key.src_ip = ip->src_addr;
+	key.dst_ip = ip->dst_addr;
+	key.proto = ip->next_proto_id;
+	/* ports of UDP and TCP, not in later fragments */
+	if ((ip->next_proto_id == IPPROTO_UDP ||
+			ip->next_proto_id == IPPROTO_TCP) &&
+			ip->version_ihl == 0x45 &&
+			(ip->fragment_offset &
+			 rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK |
+				 IPV4_HDR_MF_FLAG)) == 0)
+		memcpy(&key.ports, ip + 1, sizeof(key.ports));
+	return rte_hash_crc(&key, sizeof(key), 0) % nb_txq;
+}
+
+/*
+ * Gives every TX lcore its share of the capture, with the times its
+ * packets are due in TSC cycles from the start of a loop, scaled by
+ * --pcap-speed. A loop lasts the capture's span plus one average gap,
+ * so the first packet does not follow the last one right away. A
+ * capture without any gap goes out as fast as the port takes it.
+ */
+static void
+replay_split(unsigned *lcores, uint16_t nb_txq)
+{
+	const double speed = replay_conf.speed > 0 ? replay_conf.speed : 1;
+	uint32_t count[RTE_MAX_LCORE] = { 0 };
+	uint64_t loop_ns = replay.span_ns;
+	uint16_t *queue;
+	uint32_t i;
+	uint16_t q;
+
+	if (replay.nb_pkts > 1)
+		loop_ns += replay.span_ns / (replay.nb_pkts - 1);
+
+	queue = malloc(replay.nb_pkts * sizeof(*queue));
+	if (queue == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate replay queues\n");
+	for (i = 0; i < replay.nb_pkts; i++) {
+		queue[i] = replay_queue(replay.pkts[i], nb_txq);
+		count[queue[i]]++;
+	}
+
+	for (q = 0; q < nb_txq; q++) {
+		struct tx_replay *r = &tx_ctx[lcores[q]].replay;
+		const int socket = rte_lcore_to_socket_id(lcores[q]);
+
+		memset(r, 0, sizeof(*r));
+		r->loop_tsc = txrx_ns_to_cycles((uint64_t) (loop_ns / speed));
+		if (count[q] == 0)
+			continue;
+		r->pkts = rte_zmalloc_socket("replay_share",
+				count[q] * sizeof(*r->pkts),
+				RTE_CACHE_LINE_SIZE, socket);
+		r->at = rte_zmalloc_socket("replay_at",
+				count[q] * sizeof(*r->at),
+				RTE_CACHE_LINE_SIZE, socket);
+		if (r->pkts == NULL || r->at == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate replay share\n");
+	}
+	for (i = 0; i < replay.nb_pkts; i++) {
+		struct tx_replay *r = &tx_ctx[lcores[queue[i]]].replay;
+
+		r->pkts[r->nb] = replay.pkts[i];
+		r->at[r->nb] = txrx_ns_to_cycles((uint64_t)
+				(replay.ts_ns[i] / speed));
+		r->nb++;
+	}
+	free(queue);
+}
+
+/* Moves a replaying lcore to its next packet, and loop. */
+static inline void
+replay_next(struct tx_replay *r)
+{
+	if (++r->pos < r->nb)
+		return;
+	r->pos = 0;
+	r->loops++;
+	r->base_tsc += r->loop_tsc;
+}
+
+/* Whether an lcore sent its --pcap-loops. Loops of the warm-up do not count. */
+static inline int
+replay_done(const struct lcore_tx_ctx *ctx)
+{
+	return replay_conf.loops != 0 && ctx->replay.loops >= replay_conf.loops &&
+			(txrx_conf.warmup == 0 || ctx->epoch != 0);
+}
+
+/*
+ * The replay loop. Each TX lcore sends its share of the capture, at the
+ * captured times scaled by --pcap-speed or, with --pcap-speed 0, as fast
+ * as the pacer lets it. The mbufs are never rebuilt nor freed: every
+ * send takes a reference the PMD drops once the NIC is done with it, so
+ * a short capture may have the same mbuf in flight several times.
+ */
+static int
+lcore_replay(void *arg)
+{
+	struct lcore_tx_ctx *ctx = arg;
+	struct tx_replay *r = &ctx->replay;
+	const uint16_t burst = txrx_conf.burst;
+	const int timed = replay_conf.speed > 0;
+
+	txrx_check_lcore_socket(rte_lcore_id(), ctx->port);
+
+	printf("\nCore %u replaying %u packets on queue %u.\n",
+			rte_lcore_id(), r->nb, ctx->queue);
+
+	txrx_wait_go();
+	ctx->pacer.last_tsc = rte_rdtsc();
+	r->base_tsc = ctx->pacer.last_tsc;
+
+	txrx_poll_loop_begin(&ctx->poll);
+	while (!txrx_quit) {
+		struct rte_mbuf *bufs[MAX_BURST_SIZE];
+		uint16_t n = 0, nb_tx, i;
+
+		if (unlikely(ctx->epoch != txrx_epoch))
+			lcore_tx_restart(ctx);
+		if (replay_done(ctx) || (nb_bursts != 0 &&
+				ctx->bursts == nb_bursts &&
+				(txrx_conf.warmup == 0 || ctx->epoch != 0)))
+			break;
+
+		if (timed) {
+			const uint64_t now = rte_rdtsc();
+
+			while (n < burst && !replay_done(ctx) &&
+					r->base_tsc + r->at[r->pos] <= now) {
+				bufs[n++] = r->pkts[r->pos];
+				replay_next(r);
+			}
+			if (n == 0) {
+				rte_pause();
+				continue;
+			}
+		} else {
+			pacer_wait(&ctx->pacer, burst);
+			while (n < burst && !replay_done(ctx)) {
+				bufs[n++] = r->pkts[r->pos];
+				replay_next(r);
+			}
+			pacer_refund(&ctx->pacer, burst - n);
+		}
+		ctx->bursts++;
+
+		for (i = 0; i < n; i++)
+			rte_mbuf_refcnt_update(bufs[i], 1);
+		const uint64_t poll_tsc = txrx_poll_start();
+		nb_tx = rte_eth_tx_burst(ctx->port, ctx->queue, bufs, n);
+		txrx_poll_end(&ctx->poll.tx, poll_tsc, nb_tx, n);
+		ctx->tx_pkts += nb_tx;
+		for (i = 0; i < nb_tx; i++)
+			ctx->tx_bytes += rte_pktmbuf_pkt_len(bufs[i]);
+		if (unlikely(nb_tx < n)) {
+			ctx->tx_dropped += n - nb_tx;
+			if (!timed)
+				pacer_refund(&ctx->pacer, n - nb_tx);
+			for (i = nb_tx; i < n; i++)
+				rte_mbuf_refcnt_update(bufs[i], -1);
+		}
+	}
+	txrx_poll_loop_end(&ctx->poll);
+
+	if (rte_atomic32_dec_and_test(&tx_running))
+		txrx_quit = 1;
+	return 0;
+}
+
+/* Sums the counters of all TX lcores and reads the port counters. */
+static void
+sample_tx_stats(uint8_t port, struct txrx_sample *sample)
+{
+	unsigned lcore_id;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->tsc = rte_rdtsc();
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_tx_ctx *ctx = &tx_ctx[lcore_id];
+
+		if (ctx->mbuf_pool == NULL)
+			continue;
+		sample->pkts += ctx->tx_pkts;
+		sample->bytes += ctx->tx_bytes;
+		sample->drops += ctx->tx_dropped;
+	}
+	rte_eth_stats_get(port, &sample->eth);
+}
+
+/* Packets sent since the warm-up, for --count. */
+static uint64_t
+count_tx_pkts(void)
+{
+	uint64_t pkts = 0;
+	unsigned lcore_id;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (tx_ctx[lcore_id].mbuf_pool != NULL)
+			pkts += tx_ctx[lcore_id].tx_pkts;
+	}
+	return pkts;
+}
+
+/*
+ * The stats reporter. Every STATS_INTERVAL_MS it samples the TX lcores
+ * and the port and prints the deltas, until the last TX lcore is done,
+ * --duration is up or --count packets are sent; the last, partial
+ * interval is printed too.
+ */
+static void
+report_loop(uint8_t port)
+{
+	const uint64_t interval = txrx_ns_to_cycles(STATS_INTERVAL_MS * 1000000ULL);
+	struct txrx_sample prev, cur;
+	struct txrx_xstats xstats;
+	struct txrx_run run;
+	uint64_t start_tsc;
+	unsigned lcore_id, nb_lcores = 0;
+	int stop;
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (tx_ctx[lcore_id].mbuf_pool != NULL)
+			nb_lcores++;
+	}
+	txrx_xstats_init(&xstats, port);
+	txrx_run_start(&run, nb_lcores, count_tx_pkts);
+	sample_tx_stats(port, &prev);
+	start_tsc = prev.tsc;
+	do {
+		stop = txrx_run_wait(&run, prev.tsc + interval);
+		if (txrx_run_warm(&run)) {
+			txrx_port_stats_reset(port, &xstats);
+			sample_tx_stats(port, &prev);
+			continue;
+		}
+		sample_tx_stats(port, &cur);
+		txrx_print_interval("TX", start_tsc, &prev, &cur);
+		txrx_xstats_print(&xstats, port);
+		prev = cur;
+	} while (!stop);
+	txrx_xstats_free(&xstats);
+}
+
+static void *
+report_thread(void *arg)
+{
+	report_loop(*(uint8_t *) arg);
+	return NULL;
+}
+
+/*
+ * The lcore main. Runs on the master lcore: hands one TX queue to each of
+ * the first nb_txq slave lcores and reports their progress while they
+ * send, or sends on queue 0 itself with the reporter on a separate thread
+ * when it is the only lcore. With --pcap the lcores replay their share
+ * of the capture instead. Merges the counters once the TX loops are
+ * done.
+ */
+static void
+lcore_main(uint8_t tx_port, struct rte_mempool *mbuf_pool,
+		struct rte_mempool *payload_pool, uint16_t nb_txq)
+{
+	const int master_sends = rte_lcore_count() == 1;
+	const uint32_t nb_sports = pkt_conf.sport_max - pkt_conf.sport_min + 1;
+	const uint32_t nb_dports = pkt_conf.dport_max - pkt_conf.dport_min + 1;
+	int (*tx_loop)(void *) = replay_conf.path != NULL ? lcore_replay :
+			lcore_tx;
+	unsigned lcores[RTE_MAX_LCORE];
+	unsigned lcore_id, nb_running = 0;
+	double target_pps;
+	uint16_t q;
+
+	/* TX lcores come from the port's socket first. */
+	if (master_sends)
+		lcores[0] = rte_get_master_lcore();
+	else
+		txrx_pick_lcores(txrx_port_socket(tx_port), lcores);
+
+	/*
+	 * Split the source port range evenly between the TX queues. Every
+	 * queue needs a port of its own: two lcores sending the same flow
+	 * would interleave their sequence numbers on it.
+	 */
+	if (replay_conf.path == NULL && nb_sports < nb_txq)
+		rte_exit(EXIT_FAILURE, "%u TX queues need at least as many "
+				"source ports, have %u\n", nb_txq, nb_sports);
+	for (q = 0; q < nb_txq; q++) {
+		struct lcore_tx_ctx *ctx = &tx_ctx[lcores[q]];
+
+		lcore_id = lcores[q];
+		ctx->port = tx_port;
+		ctx->queue = q;
+		ctx->mbuf_pool = mbuf_pool;
+		if (replay_conf.path != NULL)
+			continue;
+		ctx->sport_lo = pkt_conf.sport_min + q * nb_sports / nb_txq;
+		ctx->sport_hi = pkt_conf.sport_min +
+				(q + 1) * nb_sports / nb_txq - 1;
+		ctx->sport = ctx->sport_lo;
+		ctx->dport = pkt_conf.dport_min;
+
+		const uint64_t nb_flows = (uint64_t) nb_dports *
+				(ctx->sport_hi - ctx->sport_lo + 1);
+		if (nb_flows > MAX_FLOWS_PER_LCORE)
+			rte_exit(EXIT_FAILURE, "%" PRIu64 " flows per TX lcore, "
+					"at most %u supported\n", nb_flows,
+					MAX_FLOWS_PER_LCORE);
+		ctx->flow = 0;
+		ctx->nb_flows = nb_flows;
+		ctx->seq = rte_zmalloc_socket("tx_seq",
+				nb_flows * sizeof(*ctx->seq), RTE_CACHE_LINE_SIZE,
+				rte_lcore_to_socket_id(lcore_id));
+		if (ctx->seq == NULL)
+			rte_exit(EXIT_FAILURE, "Cannot allocate sequence numbers\n");
+
+		/* Written once, from then on only referenced by every frame. */
+		if (payload_pool != NULL) {
+			const uint16_t tail_len = pkt_tx_len() - pkt_head_len();
+
+			ctx->payload = rte_pktmbuf_alloc(payload_pool);
+			if (ctx->payload == NULL)
+				rte_exit(EXIT_FAILURE, "Cannot allocate payload\n");
+			rte_memcpy(rte_pktmbuf_mtod(ctx->payload, void *),
+					pkt_template + pkt_head_len(), tail_len);
+			ctx->payload->data_len = tail_len;
+			ctx->payload->pkt_len = tail_len;
+		}
+	}
+
+	/* Queues none of the capture's flows hash to stay idle. */
+	if (replay_conf.path != NULL) {
+		replay_split(lcores, nb_txq);
+		for (q = 0; q < nb_txq; q++) {
+			if (tx_ctx[lcores[q]].replay.nb != 0)
+				continue;
+			printf("No flow of the capture for queue %u\n", q);
+			tx_ctx[lcores[q]].mbuf_pool = NULL;
+		}
+	}
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (tx_ctx[lcore_id].mbuf_pool != NULL)
+			nb_running++;
+	}
+
+	target_pps = pace_target_pps(nb_running);
+	if (target_pps > 0)
+		printf("\nPacing to %.0f pps (%.3f Gbit/s on the wire)\n",
+				target_pps, target_pps *
+				(pace_frame_len() + ETHER_L1_OVERHEAD) * 8 / 1e9);
+
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (tx_ctx[lcore_id].mbuf_pool != NULL)
+			pacer_init(&tx_ctx[lcore_id].pacer,
+					target_pps / nb_running);
+	}
+	rte_atomic32_set(&tx_running, nb_running);
+	if (!master_sends) {
+		RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+			if (tx_ctx[lcore_id].mbuf_pool != NULL)
+				rte_eal_remote_launch(tx_loop, &tx_ctx[lcore_id],
+						lcore_id);
+		}
+		report_loop(tx_port);
+		rte_eal_mp_wait_lcore();
+	} else {
+		pthread_t report_tid;
+
+		if (txrx_stats_thread_start(&report_tid, report_thread,
+				&tx_port) != 0)
+			rte_exit(EXIT_FAILURE, "Cannot start stats thread\n");
+		tx_loop(&tx_ctx[rte_get_master_lcore()]);
+		pthread_join(report_tid, NULL);
+	}
+	const uint64_t cycles = rte_rdtsc() - txrx_measure_tsc;
+
+	/* Merge the per-queue counters. */
+	uint64_t send_count = 0, send_bytes = 0, drop_count = 0;
+	RTE_LCORE_FOREACH(lcore_id) {
+		const struct lcore_tx_ctx *ctx = &tx_ctx[lcore_id];
+
+		if (ctx->mbuf_pool == NULL)
+			continue;
+		printf("queue %u (lcore %u): opackets %" PRIu64
+				" dropped %" PRIu64 "\n", ctx->queue, lcore_id,
+				ctx->tx_pkts, ctx->tx_dropped);
+		txrx_poll_print(lcore_id, &ctx->poll, txrx_conf.burst);
+		send_count += ctx->tx_pkts;
+		send_bytes += ctx->tx_bytes;
+		drop_count += ctx->tx_dropped;
+	}
+	printf("total: opackets %" PRIu64 " dropped %" PRIu64 " on %u queues\n",
+			send_count, drop_count, nb_running);
+	if (target_pps > 0) {
+		const double secs = txrx_cycles_to_sec(cycles);
+		const double achieved_pps = send_count / secs;
+
+		printf("rate requested %.0f pps, achieved %.0f pps (%.2f%%)\n",
+				target_pps, achieved_pps,
+				achieved_pps * 100 / target_pps);
+	}
+	print_eth_stats(tx_port, cycles, send_count, send_bytes);
+	txrx_print_result("tx", nb_running, send_count, send_bytes, drop_count,
+			cycles);
 }
 
 /*
@@ -237,8 +1759,9 @@ lcore_main(uint8_t tx_port, struct rte_mempool *mbuf_pool)
 int
 main(int argc, char *argv[])
 {
-	struct rte_mempool *mbuf_pool;
-	unsigned nb_ports;
+	struct rte_mempool *mbuf_pool, *tx_pool = NULL, *payload_pool = NULL;
+	unsigned nb_ports, socket;
+	uint16_t nb_txq;
 	uint8_t portid;
 
 	/* Initialize the Environment Abstraction Layer (EAL). */
@@ -249,32 +1772,74 @@ main(int argc, char *argv[])
 	argc -= ret;
 	argv += ret;
 
-	/* Check that there is an even number of ports to send/receive on. */
+	txrx_time_init();
+	txrx_signals_init();
+
+	/* parse application arguments (after the EAL ones) */
+	ret = parse_args(argc, argv);
+	if (ret < 0)
+		rte_exit(EXIT_FAILURE, "Invalid sender arguments\n");
+
 	nb_ports = rte_eth_dev_count();
 	printf("\nNnumber of Ports: %d\n", nb_ports);
-	//if (nb_ports != 1)
-	//	rte_exit(EXIT_FAILURE, "ST: Now there must be only a port\n");
+	portid = txrx_conf.port;
+	if (portid >= nb_ports)
+		rte_exit(EXIT_FAILURE, "Port %u not available\n", portid);
+
+	/* One TX queue per slave lcore (or --queues), or one on the master. */
+	nb_txq = txrx_conf_queues(rte_lcore_count() > 1 ?
+			rte_lcore_count() - 1 : 1);
+
+	/* Both pools sit on the NIC's socket, where its DMA goes. */
+	socket = txrx_port_socket(portid);
 
-	/* Creates a new mempool in memory to hold the mbufs. */
-	mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-		MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	/* Creates a new mempool in memory to hold the RX mbufs. */
+	mbuf_pool = txrx_socket_pool("MBUF_POOL",
+		socket, RTE_MAX(NUM_MBUFS,
+			txrx_conf.rx_ring_size + txrx_conf.mbuf_cache),
+		txrx_conf.mbuf_cache, RTE_MBUF_DEFAULT_BUF_SIZE);
 
-	if (mbuf_pool == NULL)
-		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+	/* A replay brings its own frames, and their size for the MTU. */
+	if (replay_conf.path != NULL)
+		tx_pool = replay_load(socket);
 
-	/* Initialize all ports. */
-	for (portid = 0; portid < nb_ports; portid++)
-		if (port_init(portid, mbuf_pool) != 0)
-			rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n",
-					portid);
+	/* Initialize the TX port. */
+	if (port_init(portid, mbuf_pool, nb_txq) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu8 "\n", portid);
 
-	if (rte_lcore_count() > 1)
-		printf("\nWARNING: more than 1 cores enabled.\n");
+	if (!pkt_conf.src_mac_set)
+		rte_eth_macaddr_get(portid, &pkt_conf.src_mac);
+	printf("\n%u TX queue(s), %u lcore(s) enabled, %u byte frames.\n",
+			nb_txq, rte_lcore_count(), pkt_conf.frame_len);
+	/*
+	 * TX frames come from their own pool so RX never overwrites them.
+	 * Every TX queue can hold a full ring plus a cache and a burst of
+	 * mbufs in flight. All mbufs get the template written up front, and
+	 * are big enough to hold a whole jumbo frame in one segment, or just
+	 * the head when the payload is chained to it. The payload segments,
+	 * one per TX lcore, come from a pool of their own.
+	 */
+	if (replay_conf.path == NULL) {
+		tx_pool = txrx_socket_pool("TX_POOL", socket,
+			txrx_conf_mbufs(NUM_MBUFS + nb_txq *
+				(txrx_conf.tx_ring_size + txrx_conf.mbuf_cache +
+				 txrx_conf.burst)),
+			txrx_conf.mbuf_cache,
+			pkt_conf.segs ? pkt_head_len() + RTE_PKTMBUF_HEADROOM :
+			RTE_MAX(RTE_MBUF_DEFAULT_BUF_SIZE,
+				pkt_conf.frame_len + RTE_PKTMBUF_HEADROOM));
+		if (pkt_conf.segs)
+			payload_pool = txrx_socket_pool("TX_PAYLOAD", socket,
+				nb_txq, 0, pkt_tx_len() - pkt_head_len() +
+				RTE_PKTMBUF_HEADROOM);
+
+		build_pkt_template();
+		rte_mempool_obj_iter(tx_pool, init_tx_mbuf, NULL);
+	}
 
-	/* on the current machine, mellanox NIC is on port 0, so we enforce the port=0 here*/
-	portid=0;
 	/* Call lcore_main on the master core only. */
-	lcore_main(portid,mbuf_pool);
+	lcore_main(portid, tx_pool, payload_pool, nb_txq);
+	txrx_port_close(portid);
 
 	return 0;
 }
@@ -0,0 +1,196 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Packet capture for the receivers. With --capture the RX lcores hand
+ *   their mbufs over SP/SC rings to a writer lcore instead of freeing
+ *   them, stamped with the TSC of their burst. The writer turns them into
+ *   pcap records (txrx_pcap.h) and frees them. An RX lcore never waits for
+ *   the disk: when its ring is full the packets are freed and counted as
+ *   capture drops, which says the writer or the disk fell behind.
+ */
+
+#ifndef _TXRX_CAPTURE_H_
+#define _TXRX_CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <rte_common.h>
+#include <rte_atomic.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include "txrx_conf.h"
+#include "txrx_pcap.h"
+
+#define CAPTURE_RING_SIZE 8192	/* mbufs queued per RX lcore */
+#define CAPTURE_BURST 64
+#define CAPTURE_IDLE_US 50	/* writer sleep when all rings are empty */
+
+static struct {
+	const char *path;	/* --capture given */
+	uint32_t snaplen;	/* 0 for whole packets */
+} txrx_capture_conf;
+
+/* The writer lcore and the rings to it, one per RX lcore. */
+struct txrx_capture {
+	struct rte_ring *rings[RTE_MAX_LCORE];
+	unsigned nb_rings;
+	unsigned lcore;
+	rte_atomic32_t producers;	/* RX lcores still running */
+	struct txrx_pcap_writer w;
+};
+
+static struct txrx_capture txrx_capture;
+
+#define TXRX_OPT_CAPTURE "capture"
+#define TXRX_OPT_SNAPLEN "snaplen"
+
+/* Above the checksum options of txrx_cksum.h. */
+enum {
+	TXRX_OPT_CAPTURE_MIN_NUM = 1280,
+	TXRX_OPT_CAPTURE_NUM,
+	TXRX_OPT_SNAPLEN_NUM,
+};
+
+#define TXRX_CAPTURE_LGOPTS \
+	{ TXRX_OPT_CAPTURE, required_argument, NULL, TXRX_OPT_CAPTURE_NUM }, \
+	{ TXRX_OPT_SNAPLEN, required_argument, NULL, TXRX_OPT_SNAPLEN_NUM }
+
+static inline void
+txrx_capture_usage(void)
+{
+	printf("  capture options:\n"
+		"  --capture FILE: write the received packets to a pcap file,\n"
+		"      from an lcore of its own\n"
+		"  --snaplen N: bytes kept per packet (default: all)\n");
+}
+
+/* Same return values as txrx_conf_parse(). */
+static inline int
+txrx_capture_parse(int opt, const char *arg)
+{
+	unsigned long n;
+
+	switch (opt) {
+	case TXRX_OPT_CAPTURE_NUM:
+		txrx_capture_conf.path = arg;
+		return 0;
+	case TXRX_OPT_SNAPLEN_NUM:
+		if (txrx_parse_uint(arg, 1, PCAP_SNAPLEN_MAX, &n) == 0) {
+			txrx_capture_conf.snaplen = n;
+			return 0;
+		}
+		break;
+	default:
+		return 1;
+	}
+	printf("invalid value %s\n", arg);
+	return -1;
+}
+
+/* Opens the capture file, written by lcore_id for nb_producers RX lcores. */
+static inline void
+txrx_capture_init(unsigned lcore_id, unsigned nb_producers)
+{
+	txrx_capture.lcore = lcore_id;
+	rte_atomic32_set(&txrx_capture.producers, nb_producers);
+	if (txrx_pcap_create(&txrx_capture.w, txrx_capture_conf.path,
+			txrx_capture_conf.snaplen) != 0)
+		rte_exit(EXIT_FAILURE, "Cannot capture\n");
+	printf("Capturing to %s on lcore %u, %u bytes per packet\n",
+			txrx_capture_conf.path, lcore_id,
+			txrx_capture.w.snaplen);
+}
+
+/* Creates the ring from an RX lcore to the writer, on the writer's socket. */
+static inline struct rte_ring *
+txrx_capture_ring(unsigned lcore_id)
+{
+	char name[RTE_RING_NAMESIZE];
+	struct rte_ring *ring;
+
+	snprintf(name, sizeof(name), "CAPTURE_%u", lcore_id);
+	ring = rte_ring_create(name, CAPTURE_RING_SIZE,
+			rte_lcore_to_socket_id(txrx_capture.lcore),
+			RING_F_SP_ENQ | RING_F_SC_DEQ);
+	if (ring == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create ring %s\n", name);
+	txrx_capture.rings[txrx_capture.nb_rings++] = ring;
+	return ring;
+}
+
+/*
+ * Hands a received burst to the writer, stamped with the TSC it came in
+ * at, and frees what does not fit the ring. Counts those in *drops.
+ */
+static inline void
+txrx_capture_burst(struct rte_ring *ring, struct rte_mbuf **bufs,
+		unsigned n, uint64_t tsc, uint64_t *drops)
+{
+	unsigned i, sent;
+
+	for (i = 0; i < n; i++)
+		bufs[i]->timestamp = tsc;
+	sent = rte_ring_sp_enqueue_burst(ring, (void **) bufs, n, NULL);
+	if (unlikely(sent < n)) {
+		*drops += n - sent;
+		for (i = sent; i < n; i++)
+			rte_pktmbuf_free(bufs[i]);
+	}
+}
+
+/* An RX lcore is done, the writer stops once all are and it drained them. */
+static inline void
+txrx_capture_done(void)
+{
+	rte_atomic32_dec(&txrx_capture.producers);
+}
+
+/* The writer lcore. */
+static inline int
+txrx_capture_lcore(void *arg __rte_unused)
+{
+	struct txrx_pcap_writer *w = &txrx_capture.w;
+	struct rte_mbuf *bufs[CAPTURE_BURST];
+	unsigned r, i, n, got;
+	int running;
+
+	do {
+		/* read before draining, nothing is enqueued after it drops */
+		running = rte_atomic32_read(&txrx_capture.producers) != 0;
+		got = 0;
+		for (r = 0; r < txrx_capture.nb_rings; r++) {
+			n = rte_ring_sc_dequeue_burst(txrx_capture.rings[r],
+					(void **) bufs, CAPTURE_BURST, NULL);
+			for (i = 0; i < n; i++) {
+				txrx_pcap_write(w, bufs[i], bufs[i]->timestamp);
+				rte_pktmbuf_free(bufs[i]);
+			}
+			got += n;
+		}
+		if (got == 0 && running)
+			usleep(CAPTURE_IDLE_US);
+	} while (running || got != 0);
+	txrx_pcap_finish(w);
+	return 0;
+}
+
+/* Prints what the writer wrote, and the drops of the RX lcores. */
+static inline void
+txrx_capture_print(uint64_t drops)
+{
+	const struct txrx_pcap_writer *w = &txrx_capture.w;
+
+	if (txrx_capture_conf.path == NULL)
+		return;
+	printf("capture: %" PRIu64 " packets, %" PRIu64 " bytes in %" PRIu64
+			" writes to %s, %" PRIu64 " dropped%s\n", w->pkts,
+			w->bytes, w->writes, w->path, drops,
+			w->failed ? ", write failed" : "");
+}
+
+#endif /* _TXRX_CAPTURE_H_ */
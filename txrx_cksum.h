@@ -0,0 +1,176 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Checksum validation of received packets for the receivers. With
+ *   --rx-cksum the port is asked to check IPv4, UDP and TCP checksums
+ *   itself and the RX loops only read the verdict from the mbuf flags.
+ *   What the NIC cannot check (no offload at all, or a protocol it does
+ *   not know) is checked in software, which costs a pass over the
+ *   payload; the report says how many packets took that path.
+ */
+
+#ifndef _TXRX_CKSUM_H_
+#define _TXRX_CKSUM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_byteorder.h>
+
+static struct {
+	uint8_t check;		/* --rx-cksum given */
+} txrx_cksum_conf;
+
+/* One per RX lcore, written only by it. */
+struct txrx_cksum_stats {
+	uint64_t checked;	/* IPv4 packets looked at */
+	uint64_t sw;		/* of them, verified in software */
+	uint64_t bad_ip;
+	uint64_t bad_l4;
+};
+
+#define TXRX_OPT_RX_CKSUM "rx-cksum"
+
+/* Above the idle options of txrx_idle.h. */
+enum {
+	TXRX_OPT_CKSUM_MIN_NUM = 1024,
+	TXRX_OPT_RX_CKSUM_NUM,
+};
+
+#define TXRX_CKSUM_LGOPTS \
+	{ TXRX_OPT_RX_CKSUM, no_argument, NULL, TXRX_OPT_RX_CKSUM_NUM }
+
+static inline void
+txrx_cksum_usage(void)
+{
+	printf("  checksum options:\n"
+		"  --rx-cksum: verify IPv4, UDP and TCP checksums, in the NIC\n"
+		"      where it can, in software otherwise\n");
+}
+
+/* Same return values as txrx_conf_parse(). */
+static inline int
+txrx_cksum_parse(int opt, const char *arg __rte_unused)
+{
+	if (opt != TXRX_OPT_RX_CKSUM_NUM)
+		return 1;
+	txrx_cksum_conf.check = 1;
+	return 0;
+}
+
+/* Turns on the port's RX checksum offload if asked for and available. */
+static inline void
+txrx_cksum_port_conf(uint8_t port, const struct rte_eth_dev_info *dev_info,
+		struct rte_eth_conf *port_conf)
+{
+	const uint32_t capa = dev_info->rx_offload_capa;
+
+	if (!txrx_cksum_conf.check)
+		return;
+	if (capa & (DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_UDP_CKSUM |
+			DEV_RX_OFFLOAD_TCP_CKSUM))
+		port_conf->rxmode.hw_ip_checksum = 1;
+	printf("Port %u RX checksum check: IPv4 %s, UDP %s, TCP %s\n", port,
+			capa & DEV_RX_OFFLOAD_IPV4_CKSUM ? "hw" : "sw",
+			capa & DEV_RX_OFFLOAD_UDP_CKSUM ? "hw" : "sw",
+			capa & DEV_RX_OFFLOAD_TCP_CKSUM ? "hw" : "sw");
+}
+
+/*
+ * Software check of what the NIC left unknown. Only unfragmented IPv4
+ * packets without options whose headers and payload are all in the
+ * first segment are checked; others are not counted as bad.
+ */
+static inline void
+txrx_cksum_check_sw(struct txrx_cksum_stats *s, struct rte_mbuf *m,
+		int check_ip, int check_l4)
+{
+	const struct ipv4_hdr *ip = rte_pktmbuf_mtod_offset(m,
+			const struct ipv4_hdr *, sizeof(struct ether_hdr));
+	const uint16_t ip_len = rte_be_to_cpu_16(ip->total_length);
+
+	if (ip->version_ihl != 0x45 ||
+			rte_pktmbuf_data_len(m) < sizeof(struct ether_hdr) +
+			ip_len || ip_len < sizeof(*ip) ||
+			(ip->fragment_offset &
+			 rte_cpu_to_be_16(~IPV4_HDR_DF_FLAG)) != 0)
+		return;
+
+	s->sw++;
+	if (check_ip && rte_raw_cksum(ip, sizeof(*ip)) != 0xffff)
+		s->bad_ip++;
+	if (!check_l4)
+		return;
+	if (ip->next_proto_id == IPPROTO_UDP) {
+		const struct udp_hdr *udp = (const struct udp_hdr *) (ip + 1);
+
+		/* zero: sent without a checksum */
+		if (ip_len >= sizeof(*ip) + sizeof(*udp) &&
+				udp->dgram_cksum != 0 &&
+				rte_ipv4_udptcp_cksum(ip, udp) != 0xffff)
+			s->bad_l4++;
+	} else if (ip->next_proto_id == IPPROTO_TCP) {
+		if (rte_ipv4_udptcp_cksum(ip, ip + 1) != 0xffff)
+			s->bad_l4++;
+	}
+}
+
+/* Counts the bad checksums of a received burst. */
+static inline void
+txrx_cksum_burst(struct txrx_cksum_stats *s, struct rte_mbuf **bufs,
+		unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		struct rte_mbuf *m = bufs[i];
+		const struct ether_hdr *eth = rte_pktmbuf_mtod(m,
+				const struct ether_hdr *);
+		const uint64_t ip_flags = m->ol_flags & PKT_RX_IP_CKSUM_MASK;
+		const uint64_t l4_flags = m->ol_flags & PKT_RX_L4_CKSUM_MASK;
+
+		if (rte_pktmbuf_data_len(m) < sizeof(*eth) +
+				sizeof(struct ipv4_hdr) ||
+				eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+			continue;
+		s->checked++;
+		if (ip_flags == PKT_RX_IP_CKSUM_BAD)
+			s->bad_ip++;
+		if (l4_flags == PKT_RX_L4_CKSUM_BAD)
+			s->bad_l4++;
+		if (ip_flags == PKT_RX_IP_CKSUM_UNKNOWN ||
+				l4_flags == PKT_RX_L4_CKSUM_UNKNOWN)
+			txrx_cksum_check_sw(s, m,
+					ip_flags == PKT_RX_IP_CKSUM_UNKNOWN,
+					l4_flags == PKT_RX_L4_CKSUM_UNKNOWN);
+	}
+}
+
+/* dst += src */
+static inline void
+txrx_cksum_merge(struct txrx_cksum_stats *dst,
+		const struct txrx_cksum_stats *src)
+{
+	dst->checked += src->checked;
+	dst->sw += src->sw;
+	dst->bad_ip += src->bad_ip;
+	dst->bad_l4 += src->bad_l4;
+}
+
+static inline void
+txrx_cksum_print(const char *what, const struct txrx_cksum_stats *s)
+{
+	if (!txrx_cksum_conf.check)
+		return;
+	printf("%s: %" PRIu64 " IPv4 packets, %" PRIu64 " bad IPv4 and %"
+			PRIu64 " bad UDP/TCP checksums, %" PRIu64
+			" checked in software\n", what, s->checked, s->bad_ip,
+			s->bad_l4, s->sw);
+}
+
+#endif /* _TXRX_CKSUM_H_ */
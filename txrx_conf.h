@@ -0,0 +1,296 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Application options shared by the sender, the receivers and the
+ *   forwarder: ring, mempool and burst sizes, the port, how many queues
+ *   to use, how long to run and when to start measuring. Each program
+ *   puts TXRX_CONF_LGOPTS into its own getopt_long table and passes every
+ *   option it does not handle itself to txrx_conf_parse().
+ */
+
+#ifndef _TXRX_CONF_H_
+#define _TXRX_CONF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <signal.h>
+#include <getopt.h>
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_mempool.h>
+#include <rte_cycles.h>
+#include <rte_atomic.h>
+#include <rte_pause.h>
+
+#include "txrx_time.h"
+
+/* Burst arrays live on the stack, sized for the largest --burst. */
+#define MAX_BURST_SIZE 512
+
+struct txrx_conf {
+	uint16_t rx_ring_size;	/* descriptors per RX queue */
+	uint16_t tx_ring_size;	/* descriptors per TX queue */
+	uint32_t nb_mbufs;	/* 0: sized by the program for its queues */
+	uint32_t mbuf_cache;
+	uint16_t burst;
+	uint8_t port;
+	uint16_t nb_queues;	/* 0: one per datapath lcore */
+	uint32_t duration;	/* seconds after the warm-up, 0: no limit */
+	uint64_t count;		/* packets after the warm-up, 0: no limit */
+	uint32_t warmup;	/* seconds not measured */
+	uint64_t start_at;	/* Unix time to start at, 0: right away */
+};
+
+static struct txrx_conf txrx_conf = {
+	.rx_ring_size = 128,
+	.tx_ring_size = 512,
+	.nb_mbufs = 0,
+	.mbuf_cache = 250,
+	.burst = 32,
+	.port = 0,
+	.nb_queues = 0,
+	.duration = 0,
+	.count = 0,
+	.warmup = 0,
+	.start_at = 0,
+};
+
+/* Set once the run is over; every datapath loop polls it. */
+static volatile int txrx_quit;
+
+/* Set when the datapath lcores may start, all at once. */
+static volatile int txrx_go;
+
+/*
+ * Bumped by the reporter when the warm-up is over. Every datapath lcore
+ * then restarts its own counters and acknowledges with txrx_epoch_ack(),
+ * so nothing of the warm-up ends up in the measurements.
+ */
+static volatile unsigned txrx_epoch;
+static rte_atomic32_t txrx_epoch_acks;
+
+/* Holds a datapath lcore until the run starts. */
+static inline void
+txrx_wait_go(void)
+{
+	while (!txrx_go && !txrx_quit)
+		rte_pause();
+}
+
+/* Tells the reporter an lcore restarted its counters for this epoch. */
+static inline void
+txrx_epoch_ack(unsigned *seen)
+{
+	*seen = txrx_epoch;
+	rte_atomic32_inc(&txrx_epoch_acks);
+}
+
+/*
+ * SIGINT and SIGTERM end the run like --duration does: the lcores leave
+ * their loops, the reporter prints the last interval and the program its
+ * totals. A second signal kills a run that does not stop.
+ */
+static void
+txrx_signal_handler(int signum)
+{
+	if (signum == SIGINT || signum == SIGTERM) {
+		printf("\n\nSignal %d received, preparing to exit...\n",
+				signum);
+		txrx_quit = 1;
+		signal(signum, SIG_DFL);
+	}
+}
+
+static inline void
+txrx_signals_init(void)
+{
+	signal(SIGINT, txrx_signal_handler);
+	signal(SIGTERM, txrx_signal_handler);
+}
+
+/* Stops and closes a port once its final counters have been read. */
+static inline void
+txrx_port_close(uint8_t port)
+{
+	printf("Closing port %u...", port);
+	rte_eth_dev_stop(port);
+	rte_eth_dev_close(port);
+	printf(" Done\n");
+}
+
+#define TXRX_OPT_RXD "rxd"
+#define TXRX_OPT_TXD "txd"
+#define TXRX_OPT_MBUFS "mbufs"
+#define TXRX_OPT_MBUF_CACHE "mbuf-cache"
+#define TXRX_OPT_BURST "burst"
+#define TXRX_OPT_PORT "port"
+#define TXRX_OPT_QUEUES "queues"
+#define TXRX_OPT_DURATION "duration"
+#define TXRX_OPT_COUNT "count"
+#define TXRX_OPT_WARMUP "warmup"
+#define TXRX_OPT_START_AT "start-at"
+
+/* Above the programs' own long option values, which start at 256. */
+enum {
+	TXRX_OPT_MIN_NUM = 512,
+	TXRX_OPT_RXD_NUM,
+	TXRX_OPT_TXD_NUM,
+	TXRX_OPT_MBUFS_NUM,
+	TXRX_OPT_MBUF_CACHE_NUM,
+	TXRX_OPT_BURST_NUM,
+	TXRX_OPT_PORT_NUM,
+	TXRX_OPT_QUEUES_NUM,
+	TXRX_OPT_DURATION_NUM,
+	TXRX_OPT_COUNT_NUM,
+	TXRX_OPT_WARMUP_NUM,
+	TXRX_OPT_START_AT_NUM,
+};
+
+#define TXRX_CONF_LGOPTS \
+	{ TXRX_OPT_RXD, required_argument, NULL, TXRX_OPT_RXD_NUM }, \
+	{ TXRX_OPT_TXD, required_argument, NULL, TXRX_OPT_TXD_NUM }, \
+	{ TXRX_OPT_MBUFS, required_argument, NULL, TXRX_OPT_MBUFS_NUM }, \
+	{ TXRX_OPT_MBUF_CACHE, required_argument, NULL, TXRX_OPT_MBUF_CACHE_NUM }, \
+	{ TXRX_OPT_BURST, required_argument, NULL, TXRX_OPT_BURST_NUM }, \
+	{ TXRX_OPT_PORT, required_argument, NULL, TXRX_OPT_PORT_NUM }, \
+	{ TXRX_OPT_QUEUES, required_argument, NULL, TXRX_OPT_QUEUES_NUM }, \
+	{ TXRX_OPT_DURATION, required_argument, NULL, TXRX_OPT_DURATION_NUM }, \
+	{ TXRX_OPT_COUNT, required_argument, NULL, TXRX_OPT_COUNT_NUM }, \
+	{ TXRX_OPT_WARMUP, required_argument, NULL, TXRX_OPT_WARMUP_NUM }, \
+	{ TXRX_OPT_START_AT, required_argument, NULL, TXRX_OPT_START_AT_NUM }
+
+static inline void
+txrx_conf_usage(void)
+{
+	printf("  common options:\n"
+		"  --rxd N, --txd N: descriptors per RX/TX queue (default %u/%u)\n"
+		"  --mbufs N: mbufs per pool (default: sized for the queues)\n"
+		"  --mbuf-cache N: per-lcore mempool cache, at most %u "
+		"(default %u)\n"
+		"  --burst N: packets per burst, 1-%u (default %u)\n"
+		"  --port P: port to use (default %u)\n"
+		"  --queues N: queues and datapath lcores to use (default: one\n"
+		"      per slave lcore; lcores themselves come from EAL -l)\n"
+		"  --duration SEC: stop after SEC seconds (default: no limit)\n"
+		"  --count N: stop after N packets (default: no limit)\n"
+		"  --warmup SEC: run SEC seconds before measuring; duration and\n"
+		"      count start after it (default 0)\n"
+		"  --start-at TIME: start at Unix time TIME, e.g. on the sender\n"
+		"      and the receiver alike (default: right away)\n",
+		txrx_conf.rx_ring_size, txrx_conf.tx_ring_size,
+		RTE_MEMPOOL_CACHE_MAX_SIZE, txrx_conf.mbuf_cache,
+		MAX_BURST_SIZE, txrx_conf.burst, txrx_conf.port);
+}
+
+static inline int
+txrx_parse_uint(const char *arg, unsigned long min, unsigned long max,
+		unsigned long *val)
+{
+	char *end;
+
+	*val = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || *val < min || *val > max)
+		return -1;
+	return 0;
+}
+
+/*
+ * Handles one of the common options. Returns 0 if it was one, 1 if opt is
+ * not a common option and -1 for an invalid value.
+ */
+static inline int
+txrx_conf_parse(int opt, const char *arg)
+{
+	unsigned long n;
+	int ret = -1;
+
+	switch (opt) {
+	case TXRX_OPT_RXD_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, UINT16_MAX, &n)) == 0)
+			txrx_conf.rx_ring_size = n;
+		break;
+	case TXRX_OPT_TXD_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, UINT16_MAX, &n)) == 0)
+			txrx_conf.tx_ring_size = n;
+		break;
+	case TXRX_OPT_MBUFS_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, UINT32_MAX, &n)) == 0)
+			txrx_conf.nb_mbufs = n;
+		break;
+	case TXRX_OPT_MBUF_CACHE_NUM:
+		if ((ret = txrx_parse_uint(arg, 0, RTE_MEMPOOL_CACHE_MAX_SIZE,
+				&n)) == 0)
+			txrx_conf.mbuf_cache = n;
+		break;
+	case TXRX_OPT_BURST_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, MAX_BURST_SIZE, &n)) == 0)
+			txrx_conf.burst = n;
+		break;
+	case TXRX_OPT_PORT_NUM:
+		if ((ret = txrx_parse_uint(arg, 0, RTE_MAX_ETHPORTS - 1,
+				&n)) == 0)
+			txrx_conf.port = n;
+		break;
+	case TXRX_OPT_QUEUES_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, RTE_MAX_LCORE, &n)) == 0)
+			txrx_conf.nb_queues = n;
+		break;
+	case TXRX_OPT_DURATION_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, UINT32_MAX, &n)) == 0)
+			txrx_conf.duration = n;
+		break;
+	case TXRX_OPT_COUNT_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, ULONG_MAX, &n)) == 0)
+			txrx_conf.count = n;
+		break;
+	case TXRX_OPT_WARMUP_NUM:
+		if ((ret = txrx_parse_uint(arg, 0, UINT32_MAX, &n)) == 0)
+			txrx_conf.warmup = n;
+		break;
+	case TXRX_OPT_START_AT_NUM:
+		if ((ret = txrx_parse_uint(arg, 1, ULONG_MAX, &n)) == 0)
+			txrx_conf.start_at = n;
+		break;
+	default:
+		return 1;
+	}
+	if (ret < 0)
+		printf("invalid value %s\n", arg);
+	return ret;
+}
+
+/*
+ * The number of queues, and datapath lcores, to use when nb_lcores lcores
+ * are available for it.
+ */
+static inline uint16_t
+txrx_conf_queues(unsigned nb_lcores)
+{
+	if (txrx_conf.nb_queues == 0)
+		return nb_lcores;
+	if (txrx_conf.nb_queues > nb_lcores)
+		rte_exit(EXIT_FAILURE, "%u queues need as many datapath lcores, "
+				"have %u\n", txrx_conf.nb_queues, nb_lcores);
+	return txrx_conf.nb_queues;
+}
+
+/* The mbuf pool size: --mbufs if given, else what the program needs. */
+static inline unsigned
+txrx_conf_mbufs(unsigned needed)
+{
+	return txrx_conf.nb_mbufs != 0 ? txrx_conf.nb_mbufs : needed;
+}
+
+/* TSC at which a run started at start_tsc ends, 0 for never. */
+static inline uint64_t
+txrx_conf_end_tsc(uint64_t start_tsc)
+{
+	if (txrx_conf.duration == 0)
+		return 0;
+	return start_tsc + txrx_ns_to_cycles(((uint64_t) txrx_conf.warmup +
+			txrx_conf.duration) * NS_PER_S);
+}
+
+#endif /* _TXRX_CONF_H_ */
@@ -0,0 +1,334 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Adaptive polling for the receive loops. By default an lcore spins on
+ *   rte_eth_rx_burst() whether or not traffic comes in. With --idle an
+ *   lcore that keeps coming back empty backs off step by step:
+ *
+ *   - after --idle-polls empty polls it rte_pause()s between polls;
+ *   - after twice that it sleeps, 1 us at first, doubling up to
+ *     IDLE_SLEEP_MAX_US;
+ *   - with --idle intr, once sleeps are that long it arms the RX
+ *     interrupts of its queues and blocks in epoll until one fires.
+ *
+ *   The first burst with packets in it puts the lcore back to busy
+ *   polling. Backing off saves cores on shared hosts at the price of the
+ *   time a packet waits for the lcore to wake up. That price is measured
+ *   with the sender's probes: the latency of the first probe seen after
+ *   every sleep or interrupt wait goes into a histogram of its own. Compare
+ *   it to the overall latency histogram.
+ */
+
+#ifndef _TXRX_IDLE_H_
+#define _TXRX_IDLE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_pause.h>
+
+#include "txrx_time.h"
+#include "txrx_probe.h"
+#include "txrx_conf.h"
+
+#define IDLE_SLEEP_MAX_US 1000
+/* An interrupt wait returns this often anyway, to notice the end of the run. */
+#define IDLE_INTR_TIMEOUT_MS 10
+#define IDLE_MAX_QUEUES 16	/* queues one lcore waits on */
+
+enum txrx_idle_mode {
+	IDLE_POLL,	/* spin, the default */
+	IDLE_SLEEP,	/* pause, then sleep */
+	IDLE_INTR,	/* pause, sleep, then RX interrupts */
+};
+
+static const char *const idle_mode_names[] = {
+	[IDLE_POLL] = "poll",
+	[IDLE_SLEEP] = "sleep",
+	[IDLE_INTR] = "intr",
+};
+
+static struct {
+	enum txrx_idle_mode mode;
+	uint32_t polls;		/* empty polls before backing off */
+} txrx_idle_conf = {
+	.mode = IDLE_POLL,
+	.polls = 256,
+};
+
+/* What an lcore is doing between polls. */
+enum txrx_idle_stage {
+	IDLE_STAGE_BUSY,
+	IDLE_STAGE_PAUSE,
+	IDLE_STAGE_SLEEP,
+};
+
+/* One per polling lcore, written only by it. */
+struct txrx_idle {
+	uint32_t empty;		/* empty polls in a row */
+	uint32_t sleep_us;	/* next sleep */
+	enum txrx_idle_stage stage;
+	uint16_t nb_intr;	/* queues armed for interrupts */
+	uint8_t intr_failed;	/* a queue has none, never wait on them */
+	struct {
+		uint8_t port;
+		uint16_t queue;
+	} intr[IDLE_MAX_QUEUES];
+
+	uint64_t pauses;
+	uint64_t sleeps;
+	uint64_t intr_waits;
+	uint64_t intr_wakes;	/* waits ended by an interrupt */
+	uint64_t asleep_cycles;	/* in usleep() and epoll */
+	struct txrx_lat_hist *wake_lat;	/* first probe after a sleep */
+};
+
+#define TXRX_OPT_IDLE "idle"
+#define TXRX_OPT_IDLE_POLLS "idle-polls"
+
+/* Above the common options of txrx_conf.h. */
+enum {
+	TXRX_OPT_IDLE_MIN_NUM = 768,
+	TXRX_OPT_IDLE_NUM,
+	TXRX_OPT_IDLE_POLLS_NUM,
+};
+
+#define TXRX_IDLE_LGOPTS \
+	{ TXRX_OPT_IDLE, required_argument, NULL, TXRX_OPT_IDLE_NUM }, \
+	{ TXRX_OPT_IDLE_POLLS, required_argument, NULL, TXRX_OPT_IDLE_POLLS_NUM }
+
+static inline void
+txrx_idle_usage(void)
+{
+	printf("  idle options:\n"
+		"  --idle poll|sleep|intr: on an idle link keep spinning, back\n"
+		"      off to pause and sleep, or further to RX interrupts\n"
+		"      (the port must support them) (default poll)\n"
+		"  --idle-polls N: empty polls before backing off (default %u)\n",
+		txrx_idle_conf.polls);
+}
+
+/* Same return values as txrx_conf_parse(). */
+static inline int
+txrx_idle_parse(int opt, const char *arg)
+{
+	unsigned long n;
+	unsigned m;
+
+	switch (opt) {
+	case TXRX_OPT_IDLE_NUM:
+		for (m = 0; m < RTE_DIM(idle_mode_names); m++) {
+			if (strcmp(arg, idle_mode_names[m]) == 0) {
+				txrx_idle_conf.mode = m;
+				return 0;
+			}
+		}
+		break;
+	case TXRX_OPT_IDLE_POLLS_NUM:
+		if (txrx_parse_uint(arg, 1, UINT32_MAX / 2, &n) == 0) {
+			txrx_idle_conf.polls = n;
+			return 0;
+		}
+		break;
+	default:
+		return 1;
+	}
+	printf("invalid value %s\n", arg);
+	return -1;
+}
+
+/* Whether ports have to be configured with RX interrupts. */
+static inline int
+txrx_idle_intr(void)
+{
+	return txrx_idle_conf.mode == IDLE_INTR;
+}
+
+/* Sets up an lcore's idle state, on that lcore. */
+static inline void
+txrx_idle_init(struct txrx_idle *idle)
+{
+	memset(idle, 0, sizeof(*idle));
+	idle->sleep_us = 1;
+	if (txrx_idle_conf.mode == IDLE_POLL)
+		return;
+	idle->wake_lat = rte_zmalloc_socket("idle_wake_lat",
+			sizeof(*idle->wake_lat), RTE_CACHE_LINE_SIZE,
+			rte_socket_id());
+	if (idle->wake_lat == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot allocate wake-up histogram\n");
+}
+
+/* Restarts the idle statistics, at the end of the warm-up. */
+static inline void
+txrx_idle_reset(struct txrx_idle *idle)
+{
+	idle->pauses = 0;
+	idle->sleeps = 0;
+	idle->intr_waits = 0;
+	idle->intr_wakes = 0;
+	idle->asleep_cycles = 0;
+	if (idle->wake_lat != NULL)
+		memset(idle->wake_lat, 0, sizeof(*idle->wake_lat));
+}
+
+/*
+ * Adds a queue the lcore polls to the ones it waits on in interrupt mode.
+ * Must run on the lcore itself, the epoll instance is per thread. A queue
+ * whose interrupt cannot be set up is only polled, the lcore then stops
+ * backing off at sleeping.
+ */
+static inline void
+txrx_idle_add_queue(struct txrx_idle *idle, uint8_t port, uint16_t queue)
+{
+	int ret;
+
+	if (!txrx_idle_intr() || idle->intr_failed)
+		return;
+	if (idle->nb_intr == IDLE_MAX_QUEUES)
+		rte_exit(EXIT_FAILURE, "More than %u queues on lcore %u\n",
+				IDLE_MAX_QUEUES, rte_lcore_id());
+	ret = rte_eth_dev_rx_intr_ctl_q(port, queue, RTE_EPOLL_PER_THREAD,
+			RTE_INTR_EVENT_ADD, NULL);
+	if (ret != 0) {
+		printf("WARNING, no RX interrupt for port %u queue %u (%d), "
+				"lcore %u will sleep instead\n", port, queue,
+				ret, rte_lcore_id());
+		/* all or nothing, the other queues would never wake it */
+		idle->nb_intr = 0;
+		idle->intr_failed = 1;
+		return;
+	}
+	idle->intr[idle->nb_intr].port = port;
+	idle->intr[idle->nb_intr].queue = queue;
+	idle->nb_intr++;
+}
+
+/* Blocks until one of the lcore's queues interrupts or the timeout. */
+static inline void
+txrx_idle_wait_intr(struct txrx_idle *idle)
+{
+	struct rte_epoll_event events[IDLE_MAX_QUEUES];
+	const uint64_t start = rte_rdtsc();
+	unsigned i;
+	int n;
+
+	for (i = 0; i < idle->nb_intr; i++)
+		rte_eth_dev_rx_intr_enable(idle->intr[i].port,
+				idle->intr[i].queue);
+	/*
+	 * A packet that came in after the last poll but before the interrupt
+	 * was armed only gets noticed at the timeout, or with the next one.
+	 */
+	n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, idle->nb_intr,
+			IDLE_INTR_TIMEOUT_MS);
+	for (i = 0; i < idle->nb_intr; i++)
+		rte_eth_dev_rx_intr_disable(idle->intr[i].port,
+				idle->intr[i].queue);
+
+	idle->intr_waits++;
+	if (n > 0)
+		idle->intr_wakes++;
+	idle->asleep_cycles += rte_rdtsc() - start;
+}
+
+/* One more empty poll: spin, pause, sleep or wait, depending on how many. */
+static inline void
+txrx_idle_backoff(struct txrx_idle *idle)
+{
+	const uint32_t polls = txrx_idle_conf.polls;
+	uint64_t start;
+
+	if (++idle->empty < polls)
+		return;
+	if (idle->empty < 2 * polls) {
+		idle->stage = IDLE_STAGE_PAUSE;
+		idle->pauses++;
+		rte_pause();
+		return;
+	}
+
+	idle->stage = IDLE_STAGE_SLEEP;
+	idle->empty = 2 * polls;	/* no wrap on long idle periods */
+	if (idle->nb_intr != 0 && idle->sleep_us >= IDLE_SLEEP_MAX_US) {
+		txrx_idle_wait_intr(idle);
+		return;
+	}
+	start = rte_rdtsc();
+	usleep(idle->sleep_us);
+	idle->asleep_cycles += rte_rdtsc() - start;
+	idle->sleeps++;
+	idle->sleep_us = RTE_MIN(idle->sleep_us * 2, IDLE_SLEEP_MAX_US);
+}
+
+/*
+ * Called after every poll round with the number of packets it brought.
+ * Returns non-zero when these are the first packets after the lcore slept,
+ * the caller then hands the first of them to txrx_idle_woke().
+ */
+static inline int
+txrx_idle_poll(struct txrx_idle *idle, unsigned nb)
+{
+	if (likely(nb != 0)) {
+		const int woke = idle->stage == IDLE_STAGE_SLEEP;
+
+		if (unlikely(idle->empty != 0)) {
+			idle->empty = 0;
+			idle->sleep_us = 1;
+			idle->stage = IDLE_STAGE_BUSY;
+		}
+		return woke;
+	}
+	if (txrx_idle_conf.mode != IDLE_POLL)
+		txrx_idle_backoff(idle);
+	return 0;
+}
+
+/*
+ * Whether the lcore slept since its last packets. For loops that poll
+ * several queues per round and have to look before they forward.
+ */
+static inline int
+txrx_idle_slept(const struct txrx_idle *idle)
+{
+	return idle->stage == IDLE_STAGE_SLEEP;
+}
+
+/* Records the wake-up latency, if m carries a probe. */
+static inline void
+txrx_idle_woke(struct txrx_idle *idle, struct rte_mbuf *m)
+{
+	const struct txrx_probe *probe = txrx_probe_get(m);
+
+	if (probe != NULL)
+		txrx_lat_record(idle->wake_lat, rte_rdtsc(), probe->tsc);
+}
+
+/* Prints how an lcore idled during a run of cycles TSC cycles. */
+static inline void
+txrx_idle_print(unsigned lcore_id, const struct txrx_idle *idle,
+		uint64_t cycles)
+{
+	char what[64];
+
+	if (idle->wake_lat == NULL || cycles == 0)
+		return;
+	printf("lcore %u idle: asleep %.1f%% of the run, %" PRIu64
+			" pauses, %" PRIu64 " sleeps, %" PRIu64
+			" interrupt waits (%" PRIu64 " woken)\n", lcore_id,
+			100.0 * idle->asleep_cycles / cycles, idle->pauses,
+			idle->sleeps, idle->intr_waits, idle->intr_wakes);
+	snprintf(what, sizeof(what), "lcore %u wake-up latency", lcore_id);
+	txrx_lat_print(what, idle->wake_lat);
+}
+
+#endif /* _TXRX_IDLE_H_ */
@@ -0,0 +1,87 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   NUMA placement shared by the sender, the receivers and the forwarder.
+ *   Packet buffers live on the socket of the NIC that DMAs into them, and
+ *   the lcores polling a port are taken from the port's socket first, so
+ *   neither descriptors nor packet data cross the socket interconnect.
+ */
+
+#ifndef _TXRX_NUMA_H_
+#define _TXRX_NUMA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+/* Socket of a port; ports without NUMA information count as socket 0. */
+static inline unsigned
+txrx_port_socket(uint8_t port)
+{
+	const int socket = rte_eth_dev_socket_id(port);
+
+	return socket < 0 ? 0 : (unsigned) socket;
+}
+
+/*
+ * Returns the mbuf pool "<prefix>_<socket>", creating it on that socket
+ * the first time. Ports on one socket share its pool.
+ */
+static inline struct rte_mempool *
+txrx_socket_pool(const char *prefix, unsigned socket, unsigned nb_mbufs,
+		unsigned cache_size, uint16_t data_room_size)
+{
+	char name[RTE_MEMPOOL_NAMESIZE];
+	struct rte_mempool *pool;
+
+	snprintf(name, sizeof(name), "%s_%u", prefix, socket);
+	pool = rte_mempool_lookup(name);
+	if (pool != NULL)
+		return pool;
+
+	pool = rte_pktmbuf_pool_create(name, nb_mbufs, cache_size, 0,
+			data_room_size, socket);
+	if (pool == NULL)
+		rte_exit(EXIT_FAILURE, "Cannot create mbuf pool %s\n", name);
+	printf("%s: %u mbufs on socket %u\n", name, nb_mbufs, socket);
+	return pool;
+}
+
+/*
+ * Lists the slave lcores, those on socket first and the others after
+ * them, and returns how many there are. Datapath lcores are taken from
+ * the front, so remote ones are only used when the local ones run out.
+ */
+static inline unsigned
+txrx_pick_lcores(unsigned socket, unsigned *lcores)
+{
+	unsigned lcore_id, n = 0;
+
+	RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+		if (rte_lcore_to_socket_id(lcore_id) == socket)
+			lcores[n++] = lcore_id;
+	}
+	RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+		if (rte_lcore_to_socket_id(lcore_id) != socket)
+			lcores[n++] = lcore_id;
+	}
+	return n;
+}
+
+/* Warns about a datapath lcore that ended up away from its port. */
+static inline void
+txrx_check_lcore_socket(unsigned lcore_id, uint8_t port)
+{
+	if (rte_lcore_to_socket_id(lcore_id) != txrx_port_socket(port))
+		printf("WARNING, lcore %u (socket %u) polls port %u on "
+				"socket %u; not enough lcores on the port's "
+				"socket\n", lcore_id,
+				rte_lcore_to_socket_id(lcore_id), port,
+				txrx_port_socket(port));
+}
+
+#endif /* _TXRX_NUMA_H_ */
@@ -0,0 +1,274 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Classic pcap files, without libpcap: the sender replays them, the
+ *   receiver captures into them. Both the microsecond and the nanosecond
+ *   variant are read, in either byte order; only Ethernet captures are
+ *   accepted. Captures are written with nanosecond timestamps, gathered
+ *   in a large buffer that goes to the file with one write() when full.
+ */
+
+#ifndef _TXRX_PCAP_H_
+#define _TXRX_PCAP_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+
+#include "txrx_time.h"
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_SNAPLEN_MAX 65535
+#define PCAP_WRITE_SIZE (4 << 20)	/* bytes per write() */
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_frac;	/* micro- or nanoseconds, by the magic */
+	uint32_t caplen;	/* bytes in the file */
+	uint32_t len;		/* bytes on the wire */
+};
+
+struct txrx_pcap_reader {
+	FILE *f;
+	const char *path;
+	int swap;		/* written on a host of the other byte order */
+	int nsec;
+};
+
+static inline uint32_t
+txrx_pcap_u32(const struct txrx_pcap_reader *r, uint32_t v)
+{
+	return r->swap ? rte_bswap32(v) : v;
+}
+
+/* Opens a capture and checks its header. Returns 0 or -1 with a message. */
+static inline int
+txrx_pcap_open(struct txrx_pcap_reader *r, const char *path)
+{
+	struct pcap_file_hdr hdr;
+
+	memset(r, 0, sizeof(*r));
+	r->path = path;
+	r->f = fopen(path, "rb");
+	if (r->f == NULL) {
+		printf("Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, r->f) != 1) {
+		printf("%s: no pcap header\n", path);
+		goto fail;
+	}
+	switch (hdr.magic) {
+	case PCAP_MAGIC_US:
+		break;
+	case PCAP_MAGIC_NS:
+		r->nsec = 1;
+		break;
+	default:
+		r->swap = 1;
+		if (rte_bswap32(hdr.magic) == PCAP_MAGIC_US)
+			break;
+		if (rte_bswap32(hdr.magic) == PCAP_MAGIC_NS) {
+			r->nsec = 1;
+			break;
+		}
+		printf("%s: not a pcap file (pcapng is not supported)\n", path);
+		goto fail;
+	}
+	if (txrx_pcap_u32(r, hdr.linktype) != PCAP_LINKTYPE_ETHERNET) {
+		printf("%s: link type %u, only Ethernet is supported\n", path,
+				txrx_pcap_u32(r, hdr.linktype));
+		goto fail;
+	}
+	return 0;
+
+fail:
+	fclose(r->f);
+	r->f = NULL;
+	return -1;
+}
+
+/*
+ * Reads the next record header. Returns 1 with its timestamp in ns,
+ * 0 at the end of the file and -1 for a truncated or corrupt file.
+ */
+static inline int
+txrx_pcap_next(struct txrx_pcap_reader *r, struct pcap_rec_hdr *rec,
+		uint64_t *ts_ns)
+{
+	if (fread(rec, sizeof(*rec), 1, r->f) != 1)
+		return feof(r->f) ? 0 : -1;
+	rec->ts_sec = txrx_pcap_u32(r, rec->ts_sec);
+	rec->ts_frac = txrx_pcap_u32(r, rec->ts_frac);
+	rec->caplen = txrx_pcap_u32(r, rec->caplen);
+	rec->len = txrx_pcap_u32(r, rec->len);
+	*ts_ns = (uint64_t) rec->ts_sec * NS_PER_S +
+			(r->nsec ? rec->ts_frac : (uint64_t) rec->ts_frac * 1000);
+	return 1;
+}
+
+/* Reads the data of the record just returned, or skips it if buf is NULL. */
+static inline int
+txrx_pcap_data(struct txrx_pcap_reader *r, const struct pcap_rec_hdr *rec,
+		void *buf)
+{
+	if (buf == NULL)
+		return fseek(r->f, rec->caplen, SEEK_CUR) == 0 ? 0 : -1;
+	return fread(buf, rec->caplen, 1, r->f) == 1 || rec->caplen == 0 ?
+			0 : -1;
+}
+
+/* Back to the first record, for a second pass. */
+static inline void
+txrx_pcap_rewind(struct txrx_pcap_reader *r)
+{
+	fseek(r->f, sizeof(struct pcap_file_hdr), SEEK_SET);
+}
+
+static inline void
+txrx_pcap_close(struct txrx_pcap_reader *r)
+{
+	if (r->f != NULL)
+		fclose(r->f);
+	r->f = NULL;
+}
+
+/* A capture being written. */
+struct txrx_pcap_writer {
+	int fd;
+	const char *path;
+	uint32_t snaplen;
+	uint8_t *buf;		/* PCAP_WRITE_SIZE bytes not written yet */
+	size_t len;
+	uint64_t base_ns;	/* wall clock at base_tsc */
+	uint64_t base_tsc;
+	int failed;		/* a write failed, the rest is dropped */
+
+	uint64_t pkts;
+	uint64_t bytes;		/* in the file */
+	uint64_t writes;
+};
+
+/* Writes out what the buffer holds. */
+static inline int
+txrx_pcap_flush(struct txrx_pcap_writer *w)
+{
+	size_t done = 0;
+
+	while (done < w->len && !w->failed) {
+		const ssize_t n = write(w->fd, w->buf + done, w->len - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			printf("Cannot write %s: %s, capture stopped\n", w->path,
+					strerror(errno));
+			w->failed = 1;
+			break;
+		}
+		done += n;
+	}
+	w->writes++;
+	w->len = 0;
+	return w->failed ? -1 : 0;
+}
+
+/*
+ * Creates a capture keeping snaplen bytes per packet, all if 0. The wall
+ * clock is read once, the packets' TSC timestamps are converted against it.
+ */
+static inline int
+txrx_pcap_create(struct txrx_pcap_writer *w, const char *path,
+		uint32_t snaplen)
+{
+	struct pcap_file_hdr hdr = {
+		.magic = PCAP_MAGIC_NS,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = snaplen != 0 ? snaplen : PCAP_SNAPLEN_MAX,
+		.linktype = PCAP_LINKTYPE_ETHERNET,
+	};
+	struct timespec ts;
+
+	memset(w, 0, sizeof(*w));
+	w->path = path;
+	w->snaplen = hdr.snaplen;
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		printf("Cannot create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	w->buf = malloc(PCAP_WRITE_SIZE);
+	if (w->buf == NULL) {
+		close(w->fd);
+		return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	w->base_tsc = rte_rdtsc();
+	w->base_ns = (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+	memcpy(w->buf, &hdr, sizeof(hdr));
+	w->len = sizeof(hdr);
+	return 0;
+}
+
+/* Adds a packet received at TSC tsc, cut to the snaplen. */
+static inline void
+txrx_pcap_write(struct txrx_pcap_writer *w, const struct rte_mbuf *m,
+		uint64_t tsc)
+{
+	const uint32_t caplen = RTE_MIN(rte_pktmbuf_pkt_len(m), w->snaplen);
+	const uint64_t ns = w->base_ns + (tsc > w->base_tsc ?
+			txrx_cycles_to_ns(tsc - w->base_tsc) : 0);
+	struct pcap_rec_hdr rec = {
+		.ts_sec = ns / NS_PER_S,
+		.ts_frac = ns % NS_PER_S,
+		.caplen = caplen,
+		.len = rte_pktmbuf_pkt_len(m),
+	};
+	const void *data;
+
+	if (w->len + sizeof(rec) + caplen > PCAP_WRITE_SIZE)
+		txrx_pcap_flush(w);
+	if (w->failed)
+		return;
+	memcpy(w->buf + w->len, &rec, sizeof(rec));
+	w->len += sizeof(rec);
+	/* copies chained mbufs, only points into single-segment ones */
+	data = rte_pktmbuf_read(m, 0, caplen, w->buf + w->len);
+	if (data != w->buf + w->len)
+		memcpy(w->buf + w->len, data, caplen);
+	w->len += caplen;
+	w->pkts++;
+	w->bytes += sizeof(rec) + caplen;
+}
+
+static inline void
+txrx_pcap_finish(struct txrx_pcap_writer *w)
+{
+	txrx_pcap_flush(w);
+	close(w->fd);
+	free(w->buf);
+	w->buf = NULL;
+}
+
+#endif /* _TXRX_PCAP_H_ */
@@ -0,0 +1,170 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Poll-efficiency accounting for the datapath loops: TSC cycles spent in
+ *   each rte_eth_rx_burst()/rte_eth_tx_burst() call, how full the bursts
+ *   come back, the share of empty polls and cycles per packet, per lcore.
+ *
+ *   Mostly empty polls with few cycles per packet mean the lcore waits for
+ *   the NIC (I/O bound); full bursts with a high cycle count per packet
+ *   outside the burst calls mean it cannot keep up (CPU bound).
+ *
+ *   It costs two TSC reads per burst call, so it is compiled out unless
+ *   TXRX_POLL_STATS is defined ("make POLL_STATS=y"); without it the hooks
+ *   below are empty and the loops are unchanged.
+ */
+
+#ifndef _TXRX_POLL_H_
+#define _TXRX_POLL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+/* Bucket 0 counts empty polls, bucket b bursts up to b/8 of the burst size. */
+#define POLL_FILL_BUCKETS 8
+
+struct txrx_poll_stats {
+	uint64_t calls;
+	uint64_t empty;
+	uint64_t pkts;
+	uint64_t cycles;	/* spent inside the burst calls */
+	uint64_t fill[POLL_FILL_BUCKETS + 1];
+};
+
+/* One per datapath lcore, written only by it. */
+struct txrx_poll_lcore {
+	uint64_t start_tsc;	/* polling loop entered */
+	uint64_t end_tsc;	/* polling loop left */
+	struct txrx_poll_stats rx;
+	struct txrx_poll_stats tx;
+};
+
+#ifdef TXRX_POLL_STATS
+
+static inline uint64_t
+txrx_poll_start(void)
+{
+	return rte_rdtsc();
+}
+
+/* Accounts a burst call started at start_tsc that moved n of burst packets. */
+static inline void
+txrx_poll_end(struct txrx_poll_stats *s, uint64_t start_tsc, unsigned n,
+		unsigned burst)
+{
+	s->cycles += rte_rdtsc() - start_tsc;
+	s->calls++;
+	s->pkts += n;
+	if (n == 0) {
+		s->empty++;
+		s->fill[0]++;
+	} else {
+		s->fill[1 + (n - 1) * POLL_FILL_BUCKETS / burst]++;
+	}
+}
+
+static inline void
+txrx_poll_loop_begin(struct txrx_poll_lcore *p)
+{
+	p->start_tsc = rte_rdtsc();
+}
+
+static inline void
+txrx_poll_loop_end(struct txrx_poll_lcore *p)
+{
+	p->end_tsc = rte_rdtsc();
+}
+
+/* Starts over, at the end of the warm-up. */
+static inline void
+txrx_poll_reset(struct txrx_poll_lcore *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->start_tsc = rte_rdtsc();
+}
+
+static inline void
+txrx_poll_print_dir(unsigned lcore_id, const char *dir,
+		const struct txrx_poll_stats *s, uint64_t loop_cycles,
+		unsigned burst)
+{
+	if (s->calls == 0)
+		return;
+
+	printf("lcore %u %s: %" PRIu64 " calls, %.1f%% empty, %.1f pkts/call,"
+			" %.0f cycles/call", lcore_id, dir, s->calls,
+			100.0 * s->empty / s->calls,
+			(double) s->pkts / s->calls,
+			(double) s->cycles / s->calls);
+	if (s->pkts != 0)
+		printf(", %.1f cycles/pkt in %s burst, %.1f in loop",
+				(double) s->cycles / s->pkts, dir,
+				(double) loop_cycles / s->pkts);
+	printf("\n    fill:");
+	for (unsigned b = 0; b <= POLL_FILL_BUCKETS; b++) {
+		if (s->fill[b] == 0)
+			continue;
+		if (b == 0)
+			printf(" 0:%.1f%%", 100.0 * s->fill[b] / s->calls);
+		else
+			printf(" <=%u:%.1f%%", b * burst / POLL_FILL_BUCKETS,
+					100.0 * s->fill[b] / s->calls);
+	}
+	printf("\n");
+}
+
+/* Prints what an lcore's polling loop did, for bursts of up to burst. */
+static inline void
+txrx_poll_print(unsigned lcore_id, const struct txrx_poll_lcore *p,
+		unsigned burst)
+{
+	const uint64_t loop_cycles = p->end_tsc - p->start_tsc;
+
+	txrx_poll_print_dir(lcore_id, "rx", &p->rx, loop_cycles, burst);
+	txrx_poll_print_dir(lcore_id, "tx", &p->tx, loop_cycles, burst);
+}
+
+#else /* !TXRX_POLL_STATS */
+
+static inline uint64_t
+txrx_poll_start(void)
+{
+	return 0;
+}
+
+static inline void
+txrx_poll_end(struct txrx_poll_stats *s __rte_unused,
+		uint64_t start_tsc __rte_unused, unsigned n __rte_unused,
+		unsigned burst __rte_unused)
+{
+}
+
+static inline void
+txrx_poll_loop_begin(struct txrx_poll_lcore *p __rte_unused)
+{
+}
+
+static inline void
+txrx_poll_loop_end(struct txrx_poll_lcore *p __rte_unused)
+{
+}
+
+static inline void
+txrx_poll_reset(struct txrx_poll_lcore *p __rte_unused)
+{
+}
+
+static inline void
+txrx_poll_print(unsigned lcore_id __rte_unused,
+		const struct txrx_poll_lcore *p __rte_unused,
+		unsigned burst __rte_unused)
+{
+}
+
+#endif /* TXRX_POLL_STATS */
+
+#endif /* _TXRX_POLL_H_ */
@@ -0,0 +1,343 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   The measurement probe the sender puts at the start of every UDP or
+ *   TCP payload, and what the receivers do with it.
+ *
+ *   Latency is the difference between the receiver's TSC and the TSC the
+ *   sender stamped right before handing the burst to the NIC. It is a
+ *   true one-way latency only when both run on the same host (loopback
+ *   cabling or two ports of one box); across hosts it includes the offset
+ *   between the two TSCs and only its spread is meaningful.
+ */
+
+#ifndef _TXRX_PROBE_H_
+#define _TXRX_PROBE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <rte_common.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+#include <rte_byteorder.h>
+
+#include "txrx_time.h"
+
+#define TXRX_PROBE_MAGIC 0x74787278	/* "txrx" */
+
+/*
+ * Right behind the UDP or TCP header. The counting pattern the sender
+ * fills the payload with continues after it. Of the frames a TSO
+ * super-frame is cut into only the first one carries it.
+ */
+struct txrx_probe {
+	uint64_t tsc;		/* sender TSC at transmit */
+	uint32_t seq;		/* per flow (5-tuple) sequence number */
+	uint32_t magic;
+} __attribute__((__packed__));
+
+#define TXRX_PROBE_OFFSET (sizeof(struct ether_hdr) + \
+		sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr))
+/* TCP without options */
+#define TXRX_PROBE_OFFSET_TCP (sizeof(struct ether_hdr) + \
+		sizeof(struct ipv4_hdr) + sizeof(struct tcp_hdr))
+
+/*
+ * Returns the probe of an Ether/IPv4/UDP or TCP packet carrying one, NULL
+ * for anything else.
+ */
+static inline struct txrx_probe *
+txrx_probe_get(struct rte_mbuf *m)
+{
+	struct ether_hdr *eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+	struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+	struct txrx_probe *probe;
+	unsigned offset = TXRX_PROBE_OFFSET;
+
+	if (unlikely(rte_pktmbuf_data_len(m) <
+			TXRX_PROBE_OFFSET + sizeof(struct txrx_probe)))
+		return NULL;
+	if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+			ip->version_ihl != 0x45)
+		return NULL;
+	if (ip->next_proto_id == IPPROTO_TCP) {
+		const struct tcp_hdr *tcp = (const struct tcp_hdr *) (ip + 1);
+
+		offset = TXRX_PROBE_OFFSET_TCP;
+		if (rte_pktmbuf_data_len(m) < offset + sizeof(*probe) ||
+				tcp->data_off != (sizeof(*tcp) / 4) << 4)
+			return NULL;
+	} else if (ip->next_proto_id != IPPROTO_UDP) {
+		return NULL;
+	}
+
+	probe = rte_pktmbuf_mtod_offset(m, struct txrx_probe *, offset);
+	if (probe->magic != TXRX_PROBE_MAGIC)
+		return NULL;
+	return probe;
+}
+
+/*
+ * Log-linear (HDR style) latency histogram in TSC cycles: every power of
+ * two is split into LAT_SUB_COUNT buckets, which keeps the relative error
+ * of any percentile below 1/LAT_SUB_COUNT. Each lcore owns one and is
+ * the only writer; readers sum them without locking.
+ */
+#define LAT_SUB_BITS 5
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS 40		/* 2^40 cycles and above share the last bucket */
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+struct txrx_lat_hist {
+	uint64_t count;
+	uint64_t invalid;	/* stamped in the future, e.g. other host's TSC */
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[LAT_BUCKETS];
+} __rte_cache_aligned;
+
+static inline unsigned
+txrx_lat_bucket(uint64_t v)
+{
+	unsigned e, shift;
+
+	if (v < LAT_SUB_COUNT)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	if (e >= LAT_MAX_BITS)
+		return LAT_BUCKETS - 1;
+	shift = e - LAT_SUB_BITS;
+	return (shift + 1) * LAT_SUB_COUNT + (v >> shift) - LAT_SUB_COUNT;
+}
+
+/* Highest value that falls into bucket b. */
+static inline uint64_t
+txrx_lat_bucket_max(unsigned b)
+{
+	unsigned shift;
+
+	if (b < LAT_SUB_COUNT)
+		return b;
+	shift = b / LAT_SUB_COUNT - 1;
+	return (((uint64_t) (b % LAT_SUB_COUNT + LAT_SUB_COUNT + 1)) << shift) - 1;
+}
+
+static inline void
+txrx_lat_record(struct txrx_lat_hist *h, uint64_t now, uint64_t tsc)
+{
+	const uint64_t lat = now - tsc;
+
+	if (unlikely((int64_t) lat < 0)) {
+		h->invalid++;
+		return;
+	}
+	if (unlikely(h->count == 0 || lat < h->min))
+		h->min = lat;
+	if (lat > h->max)
+		h->max = lat;
+	h->count++;
+	h->sum += lat;
+	h->bucket[txrx_lat_bucket(lat)]++;
+}
+
+/* dst += src */
+static inline void
+txrx_lat_merge(struct txrx_lat_hist *dst, const struct txrx_lat_hist *src)
+{
+	if (src->count != 0) {
+		if (dst->count == 0 || src->min < dst->min)
+			dst->min = src->min;
+		if (src->max > dst->max)
+			dst->max = src->max;
+	}
+	dst->count += src->count;
+	dst->invalid += src->invalid;
+	dst->sum += src->sum;
+	for (unsigned b = 0; b < LAT_BUCKETS; b++)
+		dst->bucket[b] += src->bucket[b];
+}
+
+/*
+ * dst = cur - prev, for the samples of one reporting interval. Min and
+ * max are only known to bucket precision here.
+ */
+static inline void
+txrx_lat_delta(struct txrx_lat_hist *dst, const struct txrx_lat_hist *cur,
+		const struct txrx_lat_hist *prev)
+{
+	int first = 1;
+
+	memset(dst, 0, sizeof(*dst));
+	dst->count = cur->count - prev->count;
+	dst->invalid = cur->invalid - prev->invalid;
+	dst->sum = cur->sum - prev->sum;
+	for (unsigned b = 0; b < LAT_BUCKETS; b++) {
+		dst->bucket[b] = cur->bucket[b] - prev->bucket[b];
+		if (dst->bucket[b] == 0)
+			continue;
+		if (first)
+			dst->min = txrx_lat_bucket_max(b);
+		first = 0;
+		dst->max = txrx_lat_bucket_max(b);
+	}
+}
+
+/* Value at percentile p (0-100), as the upper bound of its bucket. */
+static inline uint64_t
+txrx_lat_percentile(const struct txrx_lat_hist *h, double p)
+{
+	const uint64_t rank = (uint64_t) (p / 100 * h->count + 0.5);
+	uint64_t seen = 0;
+
+	for (unsigned b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= rank && seen > 0)
+			return RTE_MIN(txrx_lat_bucket_max(b), h->max);
+	}
+	return h->max;
+}
+
+static inline void
+txrx_lat_print(const char *what, const struct txrx_lat_hist *h)
+{
+	if (h->count == 0) {
+		if (h->invalid != 0)
+			printf("%s: no valid samples, %" PRIu64 " stamped "
+					"in the future\n", what, h->invalid);
+		return;
+	}
+
+	printf("%s (ns): n %" PRIu64 " min %" PRIu64 " avg %" PRIu64
+			" p50 %" PRIu64 " p99 %" PRIu64 " p99.9 %" PRIu64
+			" max %" PRIu64, what, h->count,
+			txrx_cycles_to_ns(h->min),
+			txrx_cycles_to_ns(h->sum / h->count),
+			txrx_cycles_to_ns(txrx_lat_percentile(h, 50)),
+			txrx_cycles_to_ns(txrx_lat_percentile(h, 99)),
+			txrx_cycles_to_ns(txrx_lat_percentile(h, 99.9)),
+			txrx_cycles_to_ns(h->max));
+	if (h->invalid != 0)
+		printf(" (%" PRIu64 " invalid)", h->invalid);
+	printf("\n");
+}
+
+/*
+ * Per-flow sequence tracking. A flow remembers the next sequence number it
+ * expects and which of the SEQ_WINDOW numbers below it have arrived, so a
+ * late packet inside the window is told apart from a duplicate. Skipped
+ * numbers count as lost until they show up late, then they move to
+ * reordered. Packets older than the window cannot be classified and are
+ * counted as stale.
+ */
+#define SEQ_WINDOW 64
+#define SEQ_GAP_BUCKETS 16	/* gap lengths 1, 2-3, 4-7, ... 32768+ */
+
+struct txrx_seq_win {
+	uint32_t next;
+	uint64_t bits;		/* bit i: next - 1 - i arrived; 0 = no packet yet */
+};
+
+struct txrx_seq_stats {
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t duplicate;
+	uint64_t stale;
+	uint64_t gaps;
+	uint64_t gap_len[SEQ_GAP_BUCKETS];
+};
+
+static inline void
+txrx_seq_track(struct txrx_seq_win *w, uint32_t seq, struct txrx_seq_stats *st)
+{
+	const int32_t d = (int32_t) (seq - w->next);
+	uint32_t off;
+
+	if (likely(d == 0 && w->bits != 0)) {
+		w->bits = (w->bits << 1) | 1;
+		w->next++;
+		return;
+	}
+	if (unlikely(w->bits == 0)) {
+		w->bits = 1;
+		w->next = seq + 1;
+		return;
+	}
+
+	if (d > 0) {
+		const unsigned b = 31 - __builtin_clz((uint32_t) d);
+
+		st->lost += d;
+		st->gaps++;
+		st->gap_len[RTE_MIN(b, SEQ_GAP_BUCKETS - 1)]++;
+		w->bits = (uint32_t) d >= SEQ_WINDOW - 1 ? 1 :
+				(w->bits << (d + 1)) | 1;
+		w->next = seq + 1;
+		return;
+	}
+
+	off = w->next - 1 - seq;
+	if (off >= SEQ_WINDOW) {
+		st->stale++;
+	} else if (w->bits & (1ULL << off)) {
+		st->duplicate++;
+	} else {
+		w->bits |= 1ULL << off;
+		st->reordered++;
+		st->lost--;
+	}
+}
+
+/* dst += src */
+static inline void
+txrx_seq_merge(struct txrx_seq_stats *dst, const struct txrx_seq_stats *src)
+{
+	dst->lost += src->lost;
+	dst->reordered += src->reordered;
+	dst->duplicate += src->duplicate;
+	dst->stale += src->stale;
+	dst->gaps += src->gaps;
+	for (unsigned b = 0; b < SEQ_GAP_BUCKETS; b++)
+		dst->gap_len[b] += src->gap_len[b];
+}
+
+/* Prints cur - prev, or cur alone with prev NULL, gap lengths included. */
+static inline void
+txrx_seq_print(const char *what, const struct txrx_seq_stats *cur,
+		const struct txrx_seq_stats *prev)
+{
+	static const struct txrx_seq_stats zero;
+
+	if (prev == NULL)
+		prev = &zero;
+	if (cur->gaps == prev->gaps && cur->duplicate == prev->duplicate &&
+			cur->stale == prev->stale &&
+			cur->reordered == prev->reordered)
+		return;
+
+	printf("%s: lost %" PRId64 " reordered %" PRIu64 " duplicate %"
+			PRIu64 " stale %" PRIu64 " gaps %" PRIu64 "\n", what,
+			(int64_t) (cur->lost - prev->lost),
+			cur->reordered - prev->reordered,
+			cur->duplicate - prev->duplicate,
+			cur->stale - prev->stale, cur->gaps - prev->gaps);
+	if (cur->gaps == prev->gaps)
+		return;
+	/* bucket b holds gaps of 2^b up to 2^(b+1) - 1 packets */
+	printf("%s gap lengths:", what);
+	for (unsigned b = 0; b < SEQ_GAP_BUCKETS; b++) {
+		const uint64_t n = cur->gap_len[b] - prev->gap_len[b];
+
+		if (n != 0)
+			printf(" %u%s:%" PRIu64, 1U << b,
+					b == SEQ_GAP_BUCKETS - 1 ? "+" : "", n);
+	}
+	printf("\n");
+}
+
+#endif /* _TXRX_PROBE_H_ */
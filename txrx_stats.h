@@ -0,0 +1,326 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Periodic statistics reporting shared by the sender and the receivers.
+ *   The datapath lcores only bump their own counters; a reporter running
+ *   on a spare lcore or on a separate thread samples them together with
+ *   the ethdev counters every interval and prints the deltas.
+ */
+
+#ifndef _TXRX_STATS_H_
+#define _TXRX_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_atomic.h>
+
+#include "txrx_time.h"
+#include "txrx_conf.h"
+
+#define STATS_INTERVAL_MS 1000
+
+/* How often a sleeping reporter checks whether it has to stop. */
+#define STATS_POLL_MS 10
+
+/* One sample of the counters a reporter watches. */
+struct txrx_sample {
+	uint64_t tsc;
+	uint64_t pkts;		/* application counters, summed over lcores */
+	uint64_t bytes;
+	uint64_t drops;
+	struct rte_eth_stats eth;
+};
+
+/* Extended stats of a port, with the values of the previous sample. */
+struct txrx_xstats {
+	int n;
+	struct rte_eth_xstat_name *names;
+	struct rte_eth_xstat *vals;
+	uint64_t *prev;
+};
+
+/*
+ * Fetches the xstat names of a port. Returns 0 on success; on failure the
+ * reporter simply runs without xstats.
+ */
+static inline int
+txrx_xstats_init(struct txrx_xstats *x, uint8_t port)
+{
+	memset(x, 0, sizeof(*x));
+	x->n = rte_eth_xstats_get_names(port, NULL, 0);
+	if (x->n <= 0)
+		goto fail;
+
+	x->names = calloc(x->n, sizeof(*x->names));
+	x->vals = calloc(x->n, sizeof(*x->vals));
+	x->prev = calloc(x->n, sizeof(*x->prev));
+	if (x->names == NULL || x->vals == NULL || x->prev == NULL ||
+			rte_eth_xstats_get_names(port, x->names, x->n) != x->n ||
+			rte_eth_xstats_get(port, x->vals, x->n) != x->n)
+		goto fail;
+	for (int i = 0; i < x->n; i++)
+		x->prev[i] = x->vals[i].value;
+	return 0;
+
+fail:
+	free(x->names);
+	free(x->vals);
+	free(x->prev);
+	memset(x, 0, sizeof(*x));
+	return -1;
+}
+
+static inline void
+txrx_xstats_free(struct txrx_xstats *x)
+{
+	free(x->names);
+	free(x->vals);
+	free(x->prev);
+	memset(x, 0, sizeof(*x));
+}
+
+/* Only loss and error xstats are printed, and only when they moved. */
+static inline int
+txrx_xstat_is_loss(const char *name)
+{
+	return strstr(name, "drop") != NULL || strstr(name, "miss") != NULL ||
+		strstr(name, "error") != NULL || strstr(name, "discard") != NULL ||
+		strstr(name, "nombuf") != NULL || strstr(name, "no_mbuf") != NULL;
+}
+
+static inline void
+txrx_xstats_print(struct txrx_xstats *x, uint8_t port)
+{
+	if (x->n == 0 || rte_eth_xstats_get(port, x->vals, x->n) != x->n)
+		return;
+
+	for (int i = 0; i < x->n; i++) {
+		const uint64_t delta = x->vals[i].value - x->prev[i];
+
+		x->prev[i] = x->vals[i].value;
+		if (delta != 0 && txrx_xstat_is_loss(x->names[i].name))
+			printf("    %s +%" PRIu64 "\n", x->names[i].name, delta);
+	}
+}
+
+/*
+ * Prints what happened between two samples: the application's own rate,
+ * drops and the ethdev counter deltas. dir is "RX" or "TX" and selects
+ * which ethdev direction is the main one.
+ */
+static inline void
+txrx_print_interval(const char *dir, uint64_t start_tsc,
+		const struct txrx_sample *prev, const struct txrx_sample *cur)
+{
+	const uint64_t cycles = cur->tsc - prev->tsc;
+	const uint64_t pkts = cur->pkts - prev->pkts;
+	const double secs = txrx_cycles_to_sec(cycles);
+	char what[32];
+
+	if (secs <= 0)
+		return;
+
+	snprintf(what, sizeof(what), "[%7.1fs] %s",
+			txrx_cycles_to_sec(cur->tsc - start_tsc), dir);
+	txrx_print_rate(what, pkts, cur->bytes - prev->bytes, cycles);
+	printf("    port ipackets +%" PRIu64 " opackets +%" PRIu64
+			" imissed +%" PRIu64 " ierrors +%" PRIu64
+			" oerrors +%" PRIu64 " rx_nombuf +%" PRIu64
+			" | app drops +%" PRIu64 "\n",
+			cur->eth.ipackets - prev->eth.ipackets,
+			cur->eth.opackets - prev->eth.opackets,
+			cur->eth.imissed - prev->eth.imissed,
+			cur->eth.ierrors - prev->eth.ierrors,
+			cur->eth.oerrors - prev->eth.oerrors,
+			cur->eth.rx_nombuf - prev->eth.rx_nombuf,
+			cur->drops - prev->drops);
+	fflush(stdout);
+}
+
+/*
+ * The summary of a run for scripts, one line of key=value pairs tagged
+ * RESULT. Cycles per packet charge every datapath lcore for the whole run,
+ * idle polls included, which is what a core budget has to pay for.
+ */
+static inline void
+txrx_print_result(const char *role, unsigned nb_lcores, uint64_t pkts,
+		uint64_t bytes, uint64_t drops, uint64_t cycles)
+{
+	const double secs = txrx_cycles_to_sec(cycles);
+
+	if (secs <= 0)
+		return;
+	printf("RESULT role=%s lcores=%u secs=%.3f pkts=%" PRIu64
+			" bytes=%" PRIu64 " drops=%" PRIu64 " pps=%.0f"
+			" l2_gbps=%.3f l1_gbps=%.3f cycles_per_pkt=%.1f\n",
+			role, nb_lcores, secs, pkts, bytes, drops, pkts / secs,
+			(bytes + pkts * ETHER_CRC_LEN) * 8 / secs / 1e9,
+			(bytes + pkts * (ETHER_CRC_LEN + ETHER_L1_OVERHEAD)) *
+				8 / secs / 1e9,
+			pkts != 0 ? (double) cycles * nb_lcores / pkts : 0.0);
+	fflush(stdout);
+}
+
+/*
+ * A run as the reporter drives it: started by txrx_run_start(), warming
+ * up until warm_tsc, then measured until end_tsc or until count packets
+ * went through. The reporter polls pkts() for the count, so a run ends
+ * within STATS_POLL_MS of reaching it.
+ */
+struct txrx_run {
+	uint64_t start_tsc;
+	uint64_t warm_tsc;	/* end of the warm-up, 0 once it is over */
+	uint64_t end_tsc;	/* 0: no duration */
+	uint64_t count;		/* 0: no packet count */
+	uint64_t (*pkts)(void);	/* packets since the warm-up */
+	unsigned nb_lcores;	/* datapath lcores restarting their counters */
+};
+
+/* Where the measurements start: the run start or the end of the warm-up. */
+static uint64_t txrx_measure_tsc;
+
+/*
+ * Waits for --start-at, if given, and lets the datapath lcores go. A run
+ * that starts late says so; the wall clocks of sender and receiver must
+ * be synchronized (NTP, PTP) for the start to be.
+ */
+static inline void
+txrx_run_start(struct txrx_run *run, unsigned nb_lcores,
+		uint64_t (*pkts)(void))
+{
+	if (txrx_conf.start_at != 0) {
+		const uint64_t at_ns = txrx_conf.start_at * NS_PER_S;
+		struct timespec ts;
+		uint64_t now_ns;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		now_ns = (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+		if (now_ns >= at_ns)
+			printf("WARNING, start time %" PRIu64 " passed %.3fs "
+					"ago\n", txrx_conf.start_at,
+					(double) (now_ns - at_ns) / NS_PER_S);
+		else
+			printf("Starting at %" PRIu64 ", in %.3fs\n",
+					txrx_conf.start_at,
+					(double) (at_ns - now_ns) / NS_PER_S);
+		while (now_ns < at_ns && !txrx_quit) {
+			usleep(RTE_MIN((at_ns - now_ns) / 1000,
+					(uint64_t) STATS_POLL_MS * 1000));
+			clock_gettime(CLOCK_REALTIME, &ts);
+			now_ns = (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+		}
+	}
+
+	run->start_tsc = rte_rdtsc();
+	run->warm_tsc = txrx_conf.warmup == 0 ? 0 : run->start_tsc +
+			txrx_ns_to_cycles(txrx_conf.warmup * NS_PER_S);
+	run->end_tsc = txrx_conf_end_tsc(run->start_tsc);
+	run->count = txrx_conf.count;
+	run->pkts = pkts;
+	run->nb_lcores = nb_lcores;
+	txrx_measure_tsc = run->start_tsc;
+	txrx_go = 1;
+	if (run->warm_tsc != 0)
+		printf("Warming up for %us\n", txrx_conf.warmup);
+}
+
+/*
+ * Sleeps until deadline or the end of the warm-up, whichever comes first.
+ * Returns non-zero once the run is over: stopped, out of time or with
+ * the packet count reached. The last two set txrx_quit.
+ */
+static inline int
+txrx_run_wait(struct txrx_run *run, uint64_t deadline)
+{
+	if (run->warm_tsc != 0 && run->warm_tsc < deadline)
+		deadline = run->warm_tsc;
+	while (!txrx_quit) {
+		const uint64_t now = rte_rdtsc();
+
+		if ((run->end_tsc != 0 && now >= run->end_tsc) ||
+				(run->count != 0 && run->warm_tsc == 0 &&
+				 run->pkts() >= run->count)) {
+			txrx_quit = 1;
+			break;
+		}
+		if (now >= deadline)
+			return 0;
+		const uint64_t left_us = txrx_cycles_to_ns(deadline - now) / 1000;
+		usleep(RTE_MIN(left_us, (uint64_t) STATS_POLL_MS * 1000));
+	}
+	return 1;
+}
+
+/*
+ * Ends the warm-up once it is due. Returns non-zero when it did: every
+ * datapath lcore has restarted its counters and the caller resets the
+ * port counters and takes a fresh sample.
+ */
+static inline int
+txrx_run_warm(struct txrx_run *run)
+{
+	if (run->warm_tsc == 0 || rte_rdtsc() < run->warm_tsc)
+		return 0;
+
+	run->warm_tsc = 0;
+	rte_atomic32_set(&txrx_epoch_acks, 0);
+	txrx_epoch++;
+	while (!txrx_quit && (unsigned) rte_atomic32_read(&txrx_epoch_acks) <
+			run->nb_lcores)
+		usleep(100);
+	txrx_measure_tsc = rte_rdtsc();
+	printf("Warm-up over, measuring\n");
+	return 1;
+}
+
+/* Restarts the counters of a port, with the xstats the reporter tracks. */
+static inline void
+txrx_port_stats_reset(uint8_t port, struct txrx_xstats *x)
+{
+	rte_eth_stats_reset(port);
+	rte_eth_xstats_reset(port);
+	if (x->n == 0 || rte_eth_xstats_get(port, x->vals, x->n) != x->n)
+		return;
+	for (int i = 0; i < x->n; i++)
+		x->prev[i] = x->vals[i].value;
+}
+
+/*
+ * Starts fn(arg) on a plain pthread, kept off the CPUs of the EAL lcores
+ * so the reporter never preempts a polling loop. This assumes the usual
+ * one-to-one lcore to CPU mapping; if every CPU is an lcore the thread
+ * keeps the affinity it inherited.
+ */
+static inline int
+txrx_stats_thread_start(pthread_t *tid, void *(*fn)(void *), void *arg)
+{
+	const long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned lcore_id;
+	cpu_set_t cpus;
+	int ret;
+
+	ret = pthread_create(tid, NULL, fn, arg);
+	if (ret != 0)
+		return -ret;
+
+	CPU_ZERO(&cpus);
+	for (long cpu = 0; cpu < nb_cpus && cpu < CPU_SETSIZE; cpu++)
+		CPU_SET(cpu, &cpus);
+	RTE_LCORE_FOREACH(lcore_id)
+		CPU_CLR(lcore_id, &cpus);
+	if (CPU_COUNT(&cpus) > 0)
+		pthread_setaffinity_np(*tid, sizeof(cpus), &cpus);
+
+	return 0;
+}
+
+#endif /* _TXRX_STATS_H_ */
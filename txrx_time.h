@@ -0,0 +1,109 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   TSC based timing and rate math shared by the sender and the receivers.
+ *   All intervals are kept as raw TSC cycles, which neither wrap in any
+ *   realistic run nor cost a system call to read, and are converted only
+ *   when printed.
+ */
+
+#ifndef _TXRX_TIME_H_
+#define _TXRX_TIME_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+
+#define NS_PER_S 1000000000ULL
+
+/* Preamble, start of frame delimiter and inter-frame gap on the wire. */
+#define ETHER_L1_OVERHEAD 20
+
+/* Calibration is checked against CLOCK_MONOTONIC_RAW over this long. */
+#define TXRX_CALIB_NS (100 * 1000 * 1000)
+
+static uint64_t txrx_tsc_hz;
+
+static inline uint64_t
+txrx_mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t) ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/*
+ * Measures the TSC rate against the monotonic clock and uses it as the
+ * time base. Must be called once after rte_eal_init(); warns when the
+ * rate the EAL assumed is off by more than 1%.
+ */
+static inline void
+txrx_time_init(void)
+{
+	const uint64_t eal_hz = rte_get_tsc_hz();
+	uint64_t ns0, ns1, tsc0, tsc1;
+
+	ns0 = txrx_mono_ns();
+	tsc0 = rte_rdtsc_precise();
+	do {
+		ns1 = txrx_mono_ns();
+	} while (ns1 - ns0 < TXRX_CALIB_NS);
+	tsc1 = rte_rdtsc_precise();
+
+	txrx_tsc_hz = (uint64_t) ((double) (tsc1 - tsc0) * NS_PER_S /
+			(ns1 - ns0));
+	if (txrx_tsc_hz > eal_hz + eal_hz / 100 ||
+			txrx_tsc_hz < eal_hz - eal_hz / 100)
+		printf("WARNING: TSC runs at %" PRIu64 " Hz, EAL assumed %"
+				PRIu64 " Hz\n", txrx_tsc_hz, eal_hz);
+}
+
+static inline uint64_t
+txrx_cycles_to_ns(uint64_t cycles)
+{
+	/* split to keep cycles * NS_PER_S from overflowing */
+	return cycles / txrx_tsc_hz * NS_PER_S +
+		cycles % txrx_tsc_hz * NS_PER_S / txrx_tsc_hz;
+}
+
+static inline uint64_t
+txrx_ns_to_cycles(uint64_t ns)
+{
+	return ns / NS_PER_S * txrx_tsc_hz +
+		ns % NS_PER_S * txrx_tsc_hz / NS_PER_S;
+}
+
+static inline double
+txrx_cycles_to_sec(uint64_t cycles)
+{
+	return (double) cycles / txrx_tsc_hz;
+}
+
+/*
+ * Prints packet and bit rates for pkts packets of bytes bytes in total
+ * (FCS excluded, as the ethdev counters and mbuf lengths are) seen over
+ * cycles TSC cycles. The L1 rate adds FCS, preamble and inter-frame gap,
+ * which is what has to match the link speed.
+ */
+static inline void
+txrx_print_rate(const char *what, uint64_t pkts, uint64_t bytes,
+		uint64_t cycles)
+{
+	const double secs = txrx_cycles_to_sec(cycles);
+	double l2_bits, l1_bits;
+
+	if (secs <= 0)
+		return;
+
+	l2_bits = (double) (bytes + pkts * ETHER_CRC_LEN) * 8;
+	l1_bits = l2_bits + (double) pkts * ETHER_L1_OVERHEAD * 8;
+	printf("%s: %.0f pps, %.3f Gbit/s L2, %.3f Gbit/s L1\n", what,
+			pkts / secs, l2_bits / secs / 1e9,
+			l1_bits / secs / 1e9);
+}
+
+#endif /* _TXRX_TIME_H_ */
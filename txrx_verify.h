@@ -0,0 +1,302 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Payload verification for the receivers. The sender fills every
+ *   payload with a counting pattern, byte i of the UDP or TCP payload
+ *   being (uint8_t) i, and puts its probe over the first bytes. With
+ *   --verify the RX loops compare what follows the probe, up to the end
+ *   of the IP packet, against that pattern, which catches corruption the
+ *   checksums miss (offloads that fix them up, rings handing out mbufs
+ *   that are still in use). Only packets with a probe are checked: the
+ *   other frames a TSO super-frame is cut into do not say where in the
+ *   pattern they start.
+ *
+ *   The compare runs 32 bytes at a time with AVX2 or 16 with SSE4.2 when
+ *   the CPU has them, a byte at a time otherwise; the kernel is picked at
+ *   start-up and can be forced to compare them. What the check costs is
+ *   measured around it and reported in cycles per checked packet.
+ */
+
+#ifndef _TXRX_VERIFY_H_
+#define _TXRX_VERIFY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <getopt.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_cpuflags.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_byteorder.h>
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+#include "txrx_probe.h"
+
+/*
+ * Compares len bytes at p with first, first + 1, ... (mod 256). Returns
+ * 0 if they all match.
+ */
+typedef int (*txrx_verify_fn)(const uint8_t *p, uint32_t len, uint8_t first);
+
+static inline int
+txrx_verify_scalar(const uint8_t *p, uint32_t len, uint8_t first)
+{
+	uint8_t diff = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+		diff |= p[i] ^ (uint8_t) (first + i);
+	return diff;
+}
+
+#ifdef RTE_ARCH_X86
+/*
+ * The vector kernels OR together the differences of the whole payload and
+ * test them once at the end, there is no branch in the loop.
+ */
+static inline __attribute__((target("sse4.2"))) int
+txrx_verify_sse42(const uint8_t *p, uint32_t len, uint8_t first)
+{
+	const __m128i step = _mm_set1_epi8(16);
+	__m128i expect = _mm_add_epi8(_mm_set1_epi8(first),
+			_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15));
+	__m128i diff = _mm_setzero_si128();
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+
+		diff = _mm_or_si128(diff, _mm_xor_si128(v, expect));
+		expect = _mm_add_epi8(expect, step);
+	}
+	return !_mm_testz_si128(diff, diff) ||
+			txrx_verify_scalar(p + i, len - i, first + i);
+}
+
+static inline __attribute__((target("avx2"))) int
+txrx_verify_avx2(const uint8_t *p, uint32_t len, uint8_t first)
+{
+	const __m256i step = _mm256_set1_epi8(32);
+	__m256i expect = _mm256_add_epi8(_mm256_set1_epi8(first),
+			_mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+				8, 9, 10, 11, 12, 13, 14, 15,
+				16, 17, 18, 19, 20, 21, 22, 23,
+				24, 25, 26, 27, 28, 29, 30, 31));
+	__m256i diff = _mm256_setzero_si256();
+	uint32_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+
+		diff = _mm256_or_si256(diff, _mm256_xor_si256(v, expect));
+		expect = _mm256_add_epi8(expect, step);
+	}
+	return !_mm256_testz_si256(diff, diff) ||
+			txrx_verify_scalar(p + i, len - i, first + i);
+}
+#endif
+
+enum txrx_verify_kernel {
+	VERIFY_OFF,
+	VERIFY_AUTO,	/* the widest the CPU has */
+	VERIFY_SCALAR,
+	VERIFY_SSE42,
+	VERIFY_AVX2,
+};
+
+static const char *const verify_kernel_names[] = {
+	[VERIFY_OFF] = "off",
+	[VERIFY_AUTO] = "auto",
+	[VERIFY_SCALAR] = "scalar",
+	[VERIFY_SSE42] = "sse4.2",
+	[VERIFY_AVX2] = "avx2",
+};
+
+static struct {
+	enum txrx_verify_kernel kernel;	/* resolved, never VERIFY_AUTO */
+	txrx_verify_fn fn;
+} txrx_verify_conf = {
+	.kernel = VERIFY_OFF,
+};
+
+/* One per RX lcore, written only by it. */
+struct txrx_verify_stats {
+	uint64_t checked;	/* packets with a probe */
+	uint64_t bytes;		/* compared, after the probes */
+	uint64_t bad;
+	uint64_t cycles;	/* in txrx_verify_probe() */
+};
+
+#define TXRX_OPT_VERIFY "verify"
+
+/* Above the capture options of txrx_capture.h. */
+enum {
+	TXRX_OPT_VERIFY_MIN_NUM = 1536,
+	TXRX_OPT_VERIFY_NUM,
+};
+
+#define TXRX_VERIFY_LGOPTS \
+	{ TXRX_OPT_VERIFY, required_argument, NULL, TXRX_OPT_VERIFY_NUM }
+
+static inline void
+txrx_verify_usage(void)
+{
+	printf("  verify options:\n"
+		"  --verify auto|scalar|sse4.2|avx2: compare the payload of\n"
+		"      the sender's packets with its counting pattern, with the\n"
+		"      widest kernel the CPU has or the one given\n");
+}
+
+/* Whether the CPU can run a kernel. */
+static inline int
+txrx_verify_supported(enum txrx_verify_kernel kernel)
+{
+	switch (kernel) {
+	case VERIFY_SCALAR:
+		return 1;
+#ifdef RTE_ARCH_X86
+	case VERIFY_SSE42:
+		return rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_2) > 0;
+	case VERIFY_AVX2:
+		return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/* Same return values as txrx_conf_parse(). */
+static inline int
+txrx_verify_parse(int opt, const char *arg)
+{
+	unsigned kernel;
+
+	if (opt != TXRX_OPT_VERIFY_NUM)
+		return 1;
+	for (kernel = VERIFY_AUTO; kernel < RTE_DIM(verify_kernel_names);
+			kernel++) {
+		if (strcmp(arg, verify_kernel_names[kernel]) == 0)
+			break;
+	}
+	if (kernel == RTE_DIM(verify_kernel_names)) {
+		printf("invalid value %s\n", arg);
+		return -1;
+	}
+	if (kernel == VERIFY_AUTO) {
+		kernel = VERIFY_AVX2;
+		while (!txrx_verify_supported(kernel))
+			kernel--;
+	} else if (!txrx_verify_supported(kernel)) {
+		printf("--verify %s: not supported by this CPU\n", arg);
+		return -1;
+	}
+
+	switch (kernel) {
+#ifdef RTE_ARCH_X86
+	case VERIFY_AVX2:
+		txrx_verify_conf.fn = txrx_verify_avx2;
+		break;
+	case VERIFY_SSE42:
+		txrx_verify_conf.fn = txrx_verify_sse42;
+		break;
+#endif
+	default:
+		txrx_verify_conf.fn = txrx_verify_scalar;
+		break;
+	}
+	txrx_verify_conf.kernel = kernel;
+	return 0;
+}
+
+/*
+ * Checks one packet whose probe is at the given offset: from the end of
+ * the probe to the end of the IP packet, so not the padding of short
+ * frames, across all segments. Returns 0 if it matches.
+ */
+static inline int
+txrx_verify_pkt(struct txrx_verify_stats *s, const struct rte_mbuf *m,
+		uint32_t probe_off)
+{
+	const struct ipv4_hdr *ip = rte_pktmbuf_mtod_offset(m,
+			const struct ipv4_hdr *, sizeof(struct ether_hdr));
+	const uint32_t end = sizeof(struct ether_hdr) +
+			rte_be_to_cpu_16(ip->total_length);
+	/* the payload, and so the pattern, starts with the probe */
+	uint32_t off = probe_off + sizeof(struct txrx_probe);
+	uint8_t expect = sizeof(struct txrx_probe);
+	uint32_t left;
+
+	if (unlikely(end > rte_pktmbuf_pkt_len(m) || end < off))
+		return -1;	/* truncated */
+	left = end - off;
+	s->bytes += left;
+
+	for (; m != NULL && left != 0; m = m->next) {
+		uint32_t len;
+
+		if (off >= m->data_len) {
+			off -= m->data_len;
+			continue;
+		}
+		len = RTE_MIN(m->data_len - off, left);
+		if (txrx_verify_conf.fn(rte_pktmbuf_mtod_offset(m,
+				const uint8_t *, off), len, expect) != 0)
+			return -1;
+		expect += len;
+		left -= len;
+		off = 0;
+	}
+	return left != 0 ? -1 : 0;
+}
+
+/*
+ * Checks the payload of a packet with the probe the RX loop found in it.
+ * Only the compare is timed, not the parsing the loop does anyway.
+ */
+static inline void
+txrx_verify_probe(struct txrx_verify_stats *s, const struct rte_mbuf *m,
+		const struct txrx_probe *probe)
+{
+	const uint64_t start = rte_rdtsc();
+
+	s->checked++;
+	if (txrx_verify_pkt(s, m, (const uint8_t *) probe -
+			rte_pktmbuf_mtod(m, const uint8_t *)) != 0)
+		s->bad++;
+	s->cycles += rte_rdtsc() - start;
+}
+
+/* dst += src */
+static inline void
+txrx_verify_merge(struct txrx_verify_stats *dst,
+		const struct txrx_verify_stats *src)
+{
+	dst->checked += src->checked;
+	dst->bytes += src->bytes;
+	dst->bad += src->bad;
+	dst->cycles += src->cycles;
+}
+
+static inline void
+txrx_verify_print(const char *what, const struct txrx_verify_stats *s)
+{
+	if (txrx_verify_conf.kernel == VERIFY_OFF)
+		return;
+	printf("%s (%s): %" PRIu64 " packets, %" PRIu64 " bad, %" PRIu64
+			" bytes compared", what,
+			verify_kernel_names[txrx_verify_conf.kernel], s->checked,
+			s->bad, s->bytes);
+	if (s->checked != 0)
+		printf(", %.1f cycles/pkt, %.2f bytes/cycle",
+				(double) s->cycles / s->checked,
+				s->cycles != 0 ? (double) s->bytes / s->cycles : 0);
+	printf("\n");
+}
+
+#endif /* _TXRX_VERIFY_H_ */